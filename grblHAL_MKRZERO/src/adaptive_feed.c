@@ -0,0 +1,191 @@
+/*
+
+  adaptive_feed.c - adaptive feed override from spindle load feedback
+
+  Lowers the feed override when spindle load rises above the setpoint and restores it when load drops.
+  The control law is run from the 1 ms SysTick interrupt every ADAPTIVE_FEED_PERIOD ms,
+  overrides are injected as realtime commands. Limits are relative to the override set by the operator,
+  changes made by the operator while the feed is reduced move the limits with them.
+
+  Use $AFC=1 to enable, $AFC=0 to disable. $AFC reports state, load and feed override.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if ADAPTIVE_FEED_ENABLE
+
+#include "adaptive_feed.h"
+#include "analog.h"
+
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+#include "grbl/nuts_bolts.h"
+
+#ifndef ADAPTIVE_FEED_CHANNEL
+#define ADAPTIVE_FEED_CHANNEL   0   // Analog input for spindle load
+#endif
+#ifndef ADAPTIVE_FEED_PERIOD
+#define ADAPTIVE_FEED_PERIOD    50  // ms
+#endif
+#ifndef ADAPTIVE_FEED_SETPOINT
+#define ADAPTIVE_FEED_SETPOINT  70  // Spindle load, percent of full scale
+#endif
+#ifndef ADAPTIVE_FEED_DEADBAND
+#define ADAPTIVE_FEED_DEADBAND  3   // Spindle load, percent of full scale
+#endif
+#ifndef ADAPTIVE_FEED_GAIN
+#define ADAPTIVE_FEED_GAIN      1   // Feed override reduction in percent per percent of load above setpoint and period
+#endif
+#ifndef ADAPTIVE_FEED_STEP
+#define ADAPTIVE_FEED_STEP      10  // Max feed override reduction in percent per period
+#endif
+#ifndef ADAPTIVE_FEED_RESTORE
+#define ADAPTIVE_FEED_RESTORE   2   // Feed override increase in percent per period when load is below setpoint
+#endif
+#ifndef ADAPTIVE_FEED_HOLD
+#define ADAPTIVE_FEED_HOLD      4   // Number of periods load has to stay below setpoint before the feed override is increased
+#endif
+#ifndef ADAPTIVE_FEED_MIN
+#define ADAPTIVE_FEED_MIN       20  // Lower feed override limit, percent of operator override
+#endif
+
+#define MAX_COMMANDS 4 // Max number of override commands injected per period
+
+static struct {
+    volatile bool enabled;
+    volatile bool adjusted;
+    uint16_t ticks;
+    uint8_t load;
+    uint8_t below;          // periods load has been below setpoint
+    volatile int32_t base;  // feed override set by the operator
+    int32_t expected;       // feed override when injected commands have been executed
+} afc = {
+    .ticks = ADAPTIVE_FEED_PERIOD
+};
+
+// Returns the change of the feed override injected, may be less than requested
+static int32_t enqueue_override (int32_t delta, uint_fast8_t commands)
+{
+    int32_t requested = delta;
+
+    while(delta && commands--) {
+        if(delta <= -10) {
+            protocol_enqueue_realtime_command(CMD_OVERRIDE_FEED_COARSE_MINUS);
+            delta += 10;
+        } else if(delta >= 10) {
+            protocol_enqueue_realtime_command(CMD_OVERRIDE_FEED_COARSE_PLUS);
+            delta -= 10;
+        } else if(delta < 0) {
+            protocol_enqueue_realtime_command(CMD_OVERRIDE_FEED_FINE_MINUS);
+            delta++;
+        } else {
+            protocol_enqueue_realtime_command(CMD_OVERRIDE_FEED_FINE_PLUS);
+            delta--;
+        }
+    }
+
+    return requested - delta;
+}
+
+// Called every ms from the SysTick interrupt
+void adaptive_feed_poll (void)
+{
+    if(--afc.ticks)
+        return;
+
+    afc.ticks = ADAPTIVE_FEED_PERIOD;
+    afc.load = (uint8_t)(((uint32_t)analog_read(ADAPTIVE_FEED_CHANNEL) * 100) / ANALOG_MAX_VALUE);
+
+    int32_t override = sys.override.feed_rate;
+
+    // Follow changes made by the operator, injected commands have been executed by the next period
+    if(!afc.adjusted)
+        afc.base = override;
+    else if(override != afc.expected)
+        afc.base += override - afc.expected;
+
+    afc.expected = override;
+
+    if(!afc.enabled || state_get() != STATE_CYCLE)
+        return;
+
+    int32_t error = (int32_t)afc.load - ADAPTIVE_FEED_SETPOINT, target = override,
+            lower = (afc.base * ADAPTIVE_FEED_MIN) / 100;
+
+    if(error > ADAPTIVE_FEED_DEADBAND) {
+        afc.below = 0;
+        target = override - min(error * ADAPTIVE_FEED_GAIN, ADAPTIVE_FEED_STEP);
+    } else if(error < -ADAPTIVE_FEED_DEADBAND) {
+        if(afc.adjusted && ++afc.below >= ADAPTIVE_FEED_HOLD)
+            target = override + ADAPTIVE_FEED_RESTORE;
+    } else
+        afc.below = 0;
+
+    if(target < lower)
+        target = lower;
+    else if(target > afc.base)
+        target = afc.base;
+
+    if(target != override) {
+        afc.expected = override + enqueue_override(target - override, MAX_COMMANDS);
+        afc.adjusted = afc.expected != afc.base;
+        if(!afc.adjusted)
+            afc.below = 0;
+    }
+}
+
+static status_code_t afc_command (sys_state_t state, char *args)
+{
+    if(args) {
+        if(!(*args == '0' || *args == '1') || args[1] != '\0')
+            return Status_InvalidStatement;
+        afc.enabled = *args == '1';
+        if(!afc.enabled && afc.adjusted) {
+            afc.adjusted = false;
+            enqueue_override(afc.base - (int32_t)sys.override.feed_rate, 255);
+        }
+    } else {
+        hal.stream.write("[AFC:");
+        hal.stream.write(afc.enabled ? "1," : "0,");
+        hal.stream.write(uitoa(afc.load));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(sys.override.feed_rate));
+        hal.stream.write("]" ASCII_EOL);
+    }
+
+    return Status_OK;
+}
+
+void adaptive_feed_init (void)
+{
+    static const sys_command_t afc_command_list[] = {
+        {"AFC", afc_command, {0}, { .str = "enable (1) or disable (0) adaptive feed override" } }
+    };
+
+    static sys_commands_t afc_commands = {
+        .n_commands = sizeof(afc_command_list) / sizeof(sys_command_t),
+        .commands = afc_command_list
+    };
+
+    system_register_commands(&afc_commands);
+}
+
+#endif // ADAPTIVE_FEED_ENABLE
@@ -0,0 +1,30 @@
+/*
+
+  adaptive_feed.h - adaptive feed override from spindle load feedback
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _ADAPTIVE_FEED_H_
+#define _ADAPTIVE_FEED_H_
+
+void adaptive_feed_init (void);
+void adaptive_feed_poll (void);
+
+#endif
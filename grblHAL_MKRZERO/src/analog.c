@@ -0,0 +1,230 @@
+/*
+
+  analog.c - analog inputs for Atmel SAMD21 ARM processor
+
+  The ADC is run in free running mode scanning ANALOG_AIN_COUNT consecutive inputs starting at
+  ANALOG_AIN_FIRST, each result is the hardware average of 16 samples.
+  Results are transferred by DMA to a RAM ring buffer, one descriptor per scan sequence. The DMA
+  interrupt at the end of each sequence checks that the ADC has wrapped around to the first input
+  and restarts the scan if not, so a missed result cannot shift results to another channel.
+  An optional window check may be set for one of the channels. It is a software compare of the
+  channel result done by the DMA interrupt at the end of each sequence, the ADC window monitor
+  (WINCTRL) is not used. Each result takes about 90 us (16 samples of 8.5 ADC clocks at 1.5 MHz),
+  a full sequence ANALOG_AIN_COUNT times that. An excursion starting just after the channel was
+  converted is thus detected up to two sequences later, about 180 us * ANALOG_AIN_COUNT plus
+  interrupt latency, and excursions shorter than one result may be averaged out.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if ANALOG_ENABLE
+
+#include "analog.h"
+#include "dma.h"
+
+#ifndef ANALOG_DEPTH
+#define ANALOG_DEPTH 8 // Number of results per channel kept in the ring buffer, used for averaging
+#endif
+
+#if ANALOG_DEPTH < 2
+#error "ANALOG_DEPTH must be at least 2!"
+#endif
+
+#define ANALOG_RING_SIZE (ANALOG_DEPTH * ANALOG_AIN_COUNT)
+
+typedef struct {
+    uint8_t port;
+    uint8_t pin;
+} ain_pin_t;
+
+// SAMD21G analog input to port pin mapping, AIN12 - AIN15 are not available on this package.
+static const ain_pin_t ain_map[] = {
+    { 0,  2 }, { 0,  3 }, { 1,  8 }, { 1,  9 }, { 0,  4 }, { 0,  5 }, { 0,  6 }, { 0,  7 },
+    { 1,  0 }, { 1,  1 }, { 1,  2 }, { 1,  3 }, { 0xFF, 0 }, { 0xFF, 0 }, { 0xFF, 0 }, { 0xFF, 0 },
+    { 0,  8 }, { 0,  9 }, { 0, 10 }, { 0, 11 }
+};
+
+static volatile uint16_t ring[ANALOG_RING_SIZE];
+static DmacDescriptor sequence_desc[ANALOG_DEPTH - 1] __attribute__((aligned(16))); // first is in the DMA descriptor table
+static uint_fast8_t sequence = 0; // ring buffer row written by the current DMA block
+static struct {
+    uint8_t channel;
+    uint16_t low;
+    uint16_t high;
+    volatile analog_window_ptr handler;
+} window = {0};
+
+static inline void adc_sync (void)
+{
+    while(ADC->STATUS.bit.SYNCBUSY);
+}
+
+// (Re)starts the scan at the first input with the DMA at the first descriptor
+static void start_scan (void)
+{
+    sequence = 0;
+
+    dma_channel_enable(DMA_CHANNEL_ADC);
+
+    ADC->CTRLA.bit.ENABLE = 1;
+    adc_sync();
+
+    ADC->SWTRIG.reg = ADC_SWTRIG_START;
+}
+
+// Called from the DMA interrupt when the result of the last input of a sequence has been transferred.
+// The ADC is then converting the first input again, if not a result has been missed or the interrupt
+// was held off for a full conversion and the channel order in the ring buffer can no longer be trusted.
+static void sequence_complete (uint8_t channel, uint8_t flags)
+{
+    uint_fast8_t row = sequence;
+
+    if(!(flags & (DMAC_CHINTFLAG_TCMPL|DMAC_CHINTFLAG_TERR)))
+        return;
+
+    if((flags & DMAC_CHINTFLAG_TERR) || ADC->INPUTCTRL.bit.INPUTOFFSET != 0) {
+
+        dma_channel_disable(DMA_CHANNEL_ADC);
+
+        ADC->CTRLA.bit.ENABLE = 0;
+        adc_sync();
+        ADC->INPUTCTRL.bit.INPUTOFFSET = 0;
+        adc_sync();
+        ADC->INTFLAG.reg = ADC_INTFLAG_RESRDY|ADC_INTFLAG_OVERRUN;
+
+        start_scan();
+
+        return;
+    }
+
+    if(++sequence == ANALOG_DEPTH)
+        sequence = 0;
+
+    if(window.handler) {
+        uint16_t value = ring[row * ANALOG_AIN_COUNT + window.channel];
+        if(value < window.low || value > window.high)
+            window.handler(window.channel, value);
+    }
+}
+
+uint8_t analog_channels (void)
+{
+    return ANALOG_AIN_COUNT;
+}
+
+// Returns average of the results in the ring buffer for the channel
+uint16_t analog_read (uint8_t channel)
+{
+    uint32_t sum = 0;
+    uint_fast16_t idx = channel;
+
+    if(channel >= ANALOG_AIN_COUNT)
+        return 0;
+
+    do {
+        sum += ring[idx];
+    } while((idx += ANALOG_AIN_COUNT) < ANALOG_RING_SIZE);
+
+    return (uint16_t)(sum / ANALOG_DEPTH);
+}
+
+// Sets the window check to fire when the channel result is outside low - high, only one channel may be monitored.
+// Set handler to NULL to disable.
+bool analog_set_window (uint8_t channel, uint16_t low, uint16_t high, analog_window_ptr handler)
+{
+    if(channel >= ANALOG_AIN_COUNT)
+        return false;
+
+    window.handler = NULL;
+    window.channel = channel;
+    window.low = low;
+    window.high = high;
+    window.handler = handler;
+
+    return true;
+}
+
+bool analog_init (void)
+{
+    uint_fast8_t idx;
+    const ain_pin_t *ain;
+
+    for(idx = 0; idx < ANALOG_AIN_COUNT; idx++) {
+        ain = &ain_map[ANALOG_AIN_FIRST + idx];
+        if(ain->port == 0xFF)
+            return false;
+        // Mux pin to peripheral function B (analog)
+        if(ain->pin & 0x01)
+            PORT->Group[ain->port].PMUX[ain->pin >> 1].bit.PMUXO = PORT_PMUX_PMUXO_B_Val;
+        else
+            PORT->Group[ain->port].PMUX[ain->pin >> 1].bit.PMUXE = PORT_PMUX_PMUXE_B_Val;
+        PORT->Group[ain->port].PINCFG[ain->pin].reg = PORT_PINCFG_PMUXEN;
+    }
+
+    PM->APBCMASK.reg |= PM_APBCMASK_ADC;
+
+    GCLK->CLKCTRL.reg = (uint16_t)(GCLK_CLKCTRL_CLKEN|GCLK_CLKCTRL_GEN_GCLK0|GCLK_CLKCTRL_ID_ADC); // 48 MHz
+    while(GCLK->STATUS.bit.SYNCBUSY);
+
+    ADC->CTRLA.bit.ENABLE = 0;
+    adc_sync();
+    ADC->CTRLA.bit.SWRST = 1;
+    while(ADC->CTRLA.bit.SWRST || ADC->STATUS.bit.SYNCBUSY);
+
+    // Load factory calibration
+    uint32_t bias = (*((uint32_t *)ADC_FUSES_BIASCAL_ADDR) & ADC_FUSES_BIASCAL_Msk) >> ADC_FUSES_BIASCAL_Pos;
+    uint32_t linearity = (*((uint32_t *)ADC_FUSES_LINEARITY_0_ADDR) & ADC_FUSES_LINEARITY_0_Msk) >> ADC_FUSES_LINEARITY_0_Pos;
+    linearity |= ((*((uint32_t *)ADC_FUSES_LINEARITY_1_ADDR) & ADC_FUSES_LINEARITY_1_Msk) >> ADC_FUSES_LINEARITY_1_Pos) << 5;
+    ADC->CALIB.reg = ADC_CALIB_BIAS_CAL(bias)|ADC_CALIB_LINEARITY_CAL(linearity);
+
+    // Full scale is VDDANA, 48 MHz / 32 = 1.5 MHz ADC clock, 16 samples hardware averaged to 12 bits
+    ADC->REFCTRL.reg = ADC_REFCTRL_REFSEL_INTVCC1|ADC_REFCTRL_REFCOMP;
+    ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_16|ADC_AVGCTRL_ADJRES(4);
+    ADC->SAMPCTRL.reg = ADC_SAMPCTRL_SAMPLEN(4);
+    ADC->CTRLB.reg = ADC_CTRLB_PRESCALER_DIV32|ADC_CTRLB_RESSEL_16BIT|ADC_CTRLB_FREERUN;
+    adc_sync();
+    ADC->INPUTCTRL.reg = ADC_INPUTCTRL_MUXPOS(ANALOG_AIN_FIRST)|ADC_INPUTCTRL_MUXNEG_GND|
+                          ADC_INPUTCTRL_INPUTSCAN(ANALOG_AIN_COUNT - 1)|ADC_INPUTCTRL_GAIN_DIV2;
+    adc_sync();
+
+    // DMA: one beat per result and one block per scan sequence, the descriptors are linked in a ring
+    // for continuous operation and interrupt at the end of each block
+    dma_init();
+
+    DmacDescriptor *desc;
+
+    for(idx = 0; idx < ANALOG_DEPTH; idx++) {
+        desc = idx ? &sequence_desc[idx - 1] : dma_descriptor(DMA_CHANNEL_ADC);
+        desc->BTCTRL.reg = DMAC_BTCTRL_VALID|DMAC_BTCTRL_BEATSIZE_HWORD|DMAC_BTCTRL_DSTINC|DMAC_BTCTRL_BLOCKACT_INT;
+        desc->BTCNT.reg = ANALOG_AIN_COUNT;
+        desc->SRCADDR.reg = (uint32_t)&ADC->RESULT.reg;
+        desc->DSTADDR.reg = (uint32_t)&ring[(idx + 1) * ANALOG_AIN_COUNT]; // End address when incrementing
+        desc->DESCADDR.reg = (uint32_t)(idx == ANALOG_DEPTH - 1 ? dma_descriptor(DMA_CHANNEL_ADC) : &sequence_desc[idx]);
+    }
+
+    dma_channel_config(DMA_CHANNEL_ADC, ADC_DMAC_ID_RESRDY, 0, sequence_complete);
+
+    start_scan();
+
+    return true;
+}
+
+#endif // ANALOG_ENABLE
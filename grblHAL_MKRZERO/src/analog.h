@@ -0,0 +1,38 @@
+/*
+
+  analog.h - analog inputs for Atmel SAMD21 ARM processor
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _ANALOG_H_
+#define _ANALOG_H_
+
+#include "driver.h"
+
+#define ANALOG_MAX_VALUE 4095 // 12 bit results
+
+typedef void (*analog_window_ptr)(uint8_t channel, uint16_t value);
+
+bool analog_init (void);
+uint8_t analog_channels (void);
+uint16_t analog_read (uint8_t channel);
+bool analog_set_window (uint8_t channel, uint16_t low, uint16_t high, analog_window_ptr handler);
+
+#endif
@@ -0,0 +1,331 @@
+/*
+
+  backlash.c - backlash compensation by hardware timed step injection
+
+  When an axis steps in the opposite direction of its previous step the configured number of extra
+  steps is output as a burst timed by TCC2, at the configured rate. Steps generated by the core for the
+  axis while the burst is running are absorbed into it, so the segment is not stretched and the
+  machine position stays consistent with the core position. Steps are netted per axis, a reversal
+  while a burst is running cancels queued steps rather than outputting them in the new direction,
+  and the injector owns the direction output of the axis until the burst has drained.
+  The initial direction of all axes is assumed to be positive.
+
+  Settings:
+    $450 - $452: X, Y and Z axis backlash, steps. 0 to disable.
+    $453: injection rate, steps/s. Should be higher than the axis max rate.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if BACKLASH_ENABLE
+
+#include "backlash.h"
+#include "mcu_pins.h"
+
+#include "grbl/nvs_buffer.h"
+#include "grbl/nuts_bolts.h"
+
+#define BACKLASH_TIMER      TCC2
+#define BACKLASH_TIMER_IRQn TCC2_IRQn
+#define BACKLASH_TIMER_CLK  (24000000UL / 16) // GCLK6 with DIV16 prescaler
+
+typedef struct {
+    uint16_t steps[N_AXIS];
+    uint16_t rate;
+} backlash_settings_t;
+
+volatile axes_signals_t backlash_injecting = {0};
+
+static backlash_settings_t backlash;
+static nvs_address_t nvs_address;
+
+static struct {
+    PortGroup *port[N_AXIS];
+    uint32_t bit[N_AXIS];
+    PortGroup *dir_port[N_AXIS];
+    uint32_t dir_bit[N_AXIS];
+    volatile int32_t debt[N_AXIS];      // motor steps left to output per axis, negative for the negative direction
+    axes_signals_t dir;                 // direction of last core step per axis
+    axes_signals_t pin_dir;             // direction output by the injector
+    axes_signals_t pin_valid;           // axes with the direction output set by the injector
+    axes_signals_t pulse_dir;           // direction of the step pulse being output
+    axes_signals_t axes;                // axes with backlash configured
+    axes_signals_t pulsed;              // axes with step output active
+    bool running;
+} inj = {0};
+
+static inline void set_dir_output (uint_fast8_t idx, bool negative)
+{
+    if(negative ^ !!(settings.steppers.dir_invert.mask & bit(idx)))
+        inj.dir_port[idx]->OUTSET.reg = inj.dir_bit[idx];
+    else
+        inj.dir_port[idx]->OUTCLR.reg = inj.dir_bit[idx];
+
+    if(negative)
+        inj.pin_dir.value |= bit(idx);
+    else
+        inj.pin_dir.value &= ~bit(idx);
+    inj.pin_valid.value |= bit(idx);
+}
+
+// Returns the direction output to the direction of the core and hands the axis back to the driver
+static inline void release_axis (uint_fast8_t idx)
+{
+    if(!(inj.pin_valid.value & bit(idx)) || ((inj.pin_dir.value ^ inj.dir.value) & bit(idx)))
+        set_dir_output(idx, !!(inj.dir.value & bit(idx)));
+
+    backlash_injecting.value &= ~bit(idx);
+}
+
+// Sets the direction output for the next step of an axis, returns false if it had to be changed.
+// The step is then output on the next interrupt to ensure direction setup time.
+static inline bool set_step_dir (uint_fast8_t idx, bool negative)
+{
+    if((inj.pin_valid.value & bit(idx)) && !!(inj.pin_dir.value & bit(idx)) == negative)
+        return true;
+
+    set_dir_output(idx, negative);
+
+    return false;
+}
+
+// Burst timer interrupt, runs at twice the injection rate: starts a step pulse on the owned axes with
+// steps left and ends it on the next interrupt. Toggles the outputs once per step in dual edge mode.
+// An axis is released when its step count reaches zero.
+static void BACKLASH_IRQHandler (void)
+{
+    int32_t debt;
+    bool negative;
+    uint_fast8_t idx = N_AXIS;
+
+    BACKLASH_TIMER->INTFLAG.reg = TCC_INTFLAG_OVF;
+
+#if STEP_DUAL_EDGE
+    do {
+        if(backlash_injecting.value & bit(--idx)) {
+            if((debt = inj.debt[idx]) == 0)
+                release_axis(idx);
+            else if(set_step_dir(idx, (negative = debt < 0))) {
+                inj.port[idx]->OUTTGL.reg = inj.bit[idx];
+                inj.debt[idx] = negative ? debt + 1 : debt - 1;
+            }
+        }
+    } while(idx);
+#else
+    if(inj.pulsed.value) {
+        do {
+            if(inj.pulsed.value & bit(--idx)) {
+                if(settings.steppers.step_invert.mask & bit(idx))
+                    inj.port[idx]->OUTSET.reg = inj.bit[idx];
+                else
+                    inj.port[idx]->OUTCLR.reg = inj.bit[idx];
+                inj.debt[idx] += (inj.pulse_dir.value & bit(idx)) ? 1 : -1;
+            }
+        } while(idx);
+        inj.pulsed.value = 0;
+    } else {
+        do {
+            if(backlash_injecting.value & bit(--idx)) {
+                if((debt = inj.debt[idx]) == 0)
+                    release_axis(idx);
+                else if(set_step_dir(idx, (negative = debt < 0))) {
+                    if(settings.steppers.step_invert.mask & bit(idx))
+                        inj.port[idx]->OUTCLR.reg = inj.bit[idx];
+                    else
+                        inj.port[idx]->OUTSET.reg = inj.bit[idx];
+                    inj.pulse_dir.value = negative ? (inj.pulse_dir.value | bit(idx)) : (inj.pulse_dir.value & ~bit(idx));
+                    inj.pulsed.value |= bit(idx);
+                }
+            }
+        } while(idx);
+    }
+#endif
+
+    if(!(inj.pulsed.value || backlash_injecting.value)) {
+        BACKLASH_TIMER->CTRLBSET.reg = TCC_CTRLBSET_CMD_STOP;
+        inj.running = false;
+    }
+}
+
+// Called from the driver pulse start functions before the step outputs are set.
+// Removes steps on axes owned by the injector from the step bits and adds them to the burst.
+// Steps are netted per axis so a reversal while a burst is running cancels queued steps in the
+// opposite direction instead of outputting them in the new direction. The injector owns the
+// direction outputs of the axes it outputs steps for.
+void backlash_pulse_start (stepper_t *stepper)
+{
+    uint_fast8_t idx = N_AXIS;
+    axes_signals_t reversed, absorb;
+
+    if(!(stepper->step_outbits.value & (inj.axes.value|backlash_injecting.value)))
+        return;
+
+    reversed.value = stepper->step_outbits.value & (stepper->dir_outbits.value ^ inj.dir.value) & inj.axes.value;
+    absorb.value = stepper->step_outbits.value & (reversed.value|backlash_injecting.value);
+
+    inj.dir.value = (inj.dir.value & ~stepper->step_outbits.value) | (stepper->dir_outbits.value & stepper->step_outbits.value);
+
+    if(absorb.value) {
+        do {
+            if(absorb.value & bit(--idx)) {
+                int32_t steps = (reversed.value & bit(idx)) ? backlash.steps[idx] + 1 : 1;
+                inj.debt[idx] += (stepper->dir_outbits.value & bit(idx)) ? -steps : steps;
+            }
+        } while(idx);
+
+        stepper->step_outbits.value &= ~absorb.value;
+        inj.pin_valid.value &= backlash_injecting.value; // Direction output state of newly owned axes is unknown
+        backlash_injecting.value |= absorb.value;
+
+        if(!inj.running) {
+            inj.running = true;
+            BACKLASH_TIMER->CTRLBSET.reg = TCC_CTRLBSET_CMD_RETRIGGER;
+        }
+    }
+}
+
+// Called by the driver from go_idle() on reset, alarm and e-stop: discards pending steps and releases
+// the step outputs. Not called when motion ends normally as the burst then still holds position steps.
+void backlash_stop (void)
+{
+    uint_fast8_t idx = N_AXIS;
+
+    __disable_irq();
+
+    BACKLASH_TIMER->CTRLBSET.reg = TCC_CTRLBSET_CMD_STOP;
+    inj.running = false;
+
+    do {
+        inj.debt[--idx] = 0;
+    } while(idx);
+
+    inj.pulsed.value = inj.pin_valid.value = 0;
+    backlash_injecting.value = 0; // The driver restores the direction outputs
+
+    __enable_irq();
+}
+
+static void backlash_configure (void)
+{
+    uint_fast8_t idx = N_AXIS;
+
+    inj.axes.value = 0;
+    do {
+        idx--;
+        if(backlash.steps[idx])
+            inj.axes.value |= bit(idx);
+    } while(idx);
+
+    uint32_t period = BACKLASH_TIMER_CLK / ((uint32_t)backlash.rate << 1);
+#if STEP_DUAL_EDGE
+    period <<= 1;
+#endif
+
+    BACKLASH_TIMER->PER.reg = period > 0xFFFF ? 0xFFFF : period - 1;
+    while(BACKLASH_TIMER->SYNCBUSY.bit.PER);
+}
+
+static const setting_detail_t backlash_settings[] = {
+    { Setting_UserDefined_0, Group_Stepper, "X-axis backlash", "step", Format_Int16, "####0", "0", "10000", Setting_NonCore, &backlash.steps[X_AXIS], NULL, NULL },
+    { Setting_UserDefined_1, Group_Stepper, "Y-axis backlash", "step", Format_Int16, "####0", "0", "10000", Setting_NonCore, &backlash.steps[Y_AXIS], NULL, NULL },
+    { Setting_UserDefined_2, Group_Stepper, "Z-axis backlash", "step", Format_Int16, "####0", "0", "10000", Setting_NonCore, &backlash.steps[Z_AXIS], NULL, NULL },
+    { Setting_UserDefined_3, Group_Stepper, "Backlash injection rate", "step/s", Format_Int16, "####0", "100", "50000", Setting_NonCore, &backlash.rate, NULL, NULL }
+};
+
+static void backlash_settings_save (void)
+{
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&backlash, sizeof(backlash_settings_t), true);
+
+    if(inj.port[X_AXIS])
+        backlash_configure();
+}
+
+static void backlash_settings_restore (void)
+{
+    backlash.steps[X_AXIS] = backlash.steps[Y_AXIS] = backlash.steps[Z_AXIS] = 0;
+    backlash.rate = 5000;
+
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&backlash, sizeof(backlash_settings_t), true);
+}
+
+static void backlash_settings_load (void)
+{
+    if(hal.nvs.memcpy_from_nvs((uint8_t *)&backlash, nvs_address, sizeof(backlash_settings_t), true) != NVS_TransferResult_OK)
+        backlash_settings_restore();
+}
+
+// Called from driver_setup() when the TCC2 clock is available
+void backlash_setup (void)
+{
+    inj.port[X_AXIS] = PIN_GROUP(X_STEP_PIN);
+    inj.bit[X_AXIS] = PIN_BIT(X_STEP_PIN);
+    inj.port[Y_AXIS] = PIN_GROUP(Y_STEP_PIN);
+    inj.bit[Y_AXIS] = PIN_BIT(Y_STEP_PIN);
+    inj.port[Z_AXIS] = PIN_GROUP(Z_STEP_PIN);
+    inj.bit[Z_AXIS] = PIN_BIT(Z_STEP_PIN);
+    inj.dir_port[X_AXIS] = PIN_GROUP(X_DIRECTION_PIN);
+    inj.dir_bit[X_AXIS] = PIN_BIT(X_DIRECTION_PIN);
+    inj.dir_port[Y_AXIS] = PIN_GROUP(Y_DIRECTION_PIN);
+    inj.dir_bit[Y_AXIS] = PIN_BIT(Y_DIRECTION_PIN);
+    inj.dir_port[Z_AXIS] = PIN_GROUP(Z_DIRECTION_PIN);
+    inj.dir_bit[Z_AXIS] = PIN_BIT(Z_DIRECTION_PIN);
+
+    PM->APBCMASK.reg |= PM_APBCMASK_TCC2;
+
+    BACKLASH_TIMER->CTRLA.bit.ENABLE = 0;
+    while(BACKLASH_TIMER->SYNCBUSY.bit.ENABLE);
+    BACKLASH_TIMER->CTRLA.bit.SWRST = 1;
+    while(BACKLASH_TIMER->SYNCBUSY.bit.SWRST);
+
+    BACKLASH_TIMER->CTRLA.reg = TCC_CTRLA_PRESCALER_DIV16;
+    BACKLASH_TIMER->WAVE.reg = TCC_WAVE_WAVEGEN_NFRQ;
+    while(BACKLASH_TIMER->SYNCBUSY.bit.WAVE);
+
+    backlash_configure();
+
+    BACKLASH_TIMER->INTENSET.reg = TCC_INTENSET_OVF;
+
+    // Same priority as the stepper interrupt, they access the step counts
+    IRQRegister(BACKLASH_TIMER_IRQn, BACKLASH_IRQHandler);
+    NVIC_SetPriority(BACKLASH_TIMER_IRQn, 2);
+    NVIC_EnableIRQ(BACKLASH_TIMER_IRQn);
+
+    BACKLASH_TIMER->CTRLA.bit.ENABLE = 1;
+    while(BACKLASH_TIMER->SYNCBUSY.bit.ENABLE);
+    BACKLASH_TIMER->CTRLBSET.reg = TCC_CTRLBSET_CMD_STOP;
+    while(BACKLASH_TIMER->SYNCBUSY.bit.CTRLB);
+}
+
+void backlash_init (void)
+{
+    static setting_details_t setting_details = {
+        .settings = backlash_settings,
+        .n_settings = sizeof(backlash_settings) / sizeof(setting_detail_t),
+        .save = backlash_settings_save,
+        .load = backlash_settings_load,
+        .restore = backlash_settings_restore
+    };
+
+    if((nvs_address = nvs_alloc(sizeof(backlash_settings_t))))
+        settings_register(&setting_details);
+}
+
+#endif // BACKLASH_ENABLE
@@ -0,0 +1,37 @@
+/*
+
+  backlash.h - backlash compensation by hardware timed step injection
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _BACKLASH_H_
+#define _BACKLASH_H_
+
+#include "grbl/hal.h"
+
+// Axes with step and direction outputs owned by the injector, the driver must not change these outputs
+extern volatile axes_signals_t backlash_injecting;
+
+void backlash_init (void);
+void backlash_setup (void);
+void backlash_pulse_start (stepper_t *stepper);
+void backlash_stop (void);
+
+#endif
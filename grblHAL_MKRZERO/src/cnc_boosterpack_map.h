@@ -79,6 +79,10 @@
 // Define probe switch input pin.
 #define PROBE_PIN           (18u)
 
+// Define auxiliary output pins, used for M62-M65.
+#define AUXOUTPUT0_PIN      (10u) // GPIO1
+#define AUXOUTPUT1_PIN      (4u)  // GPIO2
+
 #if IOEXPAND_ENABLE
 
 typedef union {
@@ -0,0 +1,199 @@
+/*
+
+  crc.c - CRC32 (IEEE 802.3, as zlib crc32()) service
+
+  The word aligned part of a buffer is processed by the Device Service Unit (DSU) CRC32 engine,
+  unaligned head and tail bytes and calls made while the DSU is busy, e.g. from an interrupt,
+  use the software implementation. Build with CRC_HOST defined for software only.
+  With SDCARD_ENABLE $CRC=<file> reports the CRC32 and size of a file for verifying uploads.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifdef CRC_HOST
+#include <stdbool.h>
+#else
+#include "driver.h"
+#endif
+
+#include "crc.h"
+
+#if SDCARD_ENABLE
+#include "ff.h"
+#include "grbl/nuts_bolts.h"
+#endif
+
+#define DSU_MIN_LENGTH 16 // bytes, shorter aligned blocks are handled in software
+
+static uint32_t crc32_sw (uint32_t c, const uint8_t *data, size_t length)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    while(length--) {
+        c ^= *data++;
+        c = (c >> 4) ^ table[c & 0x0F];
+        c = (c >> 4) ^ table[c & 0x0F];
+    }
+
+    return c;
+}
+
+#ifdef CRC_HOST
+
+void crc_init (void)
+{
+}
+
+uint32_t crc32_update (uint32_t crc, const void *data, size_t length)
+{
+    return ~crc32_sw(~crc, (const uint8_t *)data, length);
+}
+
+#else
+
+static volatile bool dsu_busy = false;
+
+// Returns false on bus error, c is left unchanged then
+static bool crc32_dsu (uint32_t *c, const uint32_t *data, size_t length)
+{
+    DSU->STATUSA.reg = DSU_STATUSA_DONE|DSU_STATUSA_BERR;
+    DSU->ADDR.reg = (uint32_t)data;
+    DSU->LENGTH.reg = length & ~0x03;
+    DSU->DATA.reg = *c;
+    DSU->CTRL.reg = DSU_CTRL_CRC;
+
+    while(!DSU->STATUSA.bit.DONE);
+
+    if(DSU->STATUSA.bit.BERR)
+        return false;
+
+    *c = DSU->DATA.reg;
+
+    return true;
+}
+
+uint32_t crc32_update (uint32_t crc, const void *data, size_t length)
+{
+    bool use_dsu;
+    uint32_t c = ~crc;
+    const uint8_t *p = (const uint8_t *)data;
+    size_t head = (4 - ((uint32_t)p & 0x03)) & 0x03;
+
+    if(length < head + DSU_MIN_LENGTH)
+        return ~crc32_sw(c, p, length);
+
+    c = crc32_sw(c, p, head);
+    p += head;
+    length -= head;
+
+    __disable_irq();
+    if((use_dsu = !dsu_busy))
+        dsu_busy = true;
+    __enable_irq();
+
+    if(use_dsu) {
+        if(crc32_dsu(&c, (const uint32_t *)p, length)) {
+            p += length & ~0x03;
+            length &= 0x03;
+        }
+        dsu_busy = false;
+    }
+
+    return ~crc32_sw(c, p, length);
+}
+
+#if SDCARD_ENABLE
+
+static char *hex32 (char *s, uint32_t value)
+{
+    uint_fast8_t i = 8;
+
+    s[8] = '\0';
+    do {
+        s[--i] = "0123456789ABCDEF"[value & 0x0F];
+        value >>= 4;
+    } while(i);
+
+    return s;
+}
+
+static status_code_t crc_file (sys_state_t state, char *args)
+{
+    FIL file;
+    UINT bytes;
+    char hex[9];
+    uint32_t crc = 0, size = 0;
+    static uint8_t buffer[512] __attribute__((aligned(4)));
+
+    if(args == NULL)
+        return Status_InvalidStatement;
+
+    if(hal.stream.type == StreamType_SDCard)
+        return Status_IdleError;
+
+    if(f_open(&file, args, FA_READ) != FR_OK)
+        return Status_SDReadError;
+
+    do {
+        if(f_read(&file, buffer, sizeof(buffer), &bytes) != FR_OK) {
+            f_close(&file);
+            return Status_SDReadError;
+        }
+        crc = crc32_update(crc, buffer, bytes);
+        size += bytes;
+    } while(bytes == sizeof(buffer));
+
+    f_close(&file);
+
+    hal.stream.write("[CRC:");
+    hal.stream.write(hex32(hex, crc));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(size));
+    hal.stream.write("]" ASCII_EOL);
+
+    return Status_OK;
+}
+
+#endif // SDCARD_ENABLE
+
+void crc_init (void)
+{
+    // The DSU is write protected after reset
+    PAC1->WPCLR.reg = 1 << (ID_DSU % 32);
+
+#if SDCARD_ENABLE
+
+    static const sys_command_t crc_command_list[] = {
+        {"CRC", crc_file, {0}, { .str = "report CRC32 and size of SD card file, $CRC=<filename>" } }
+    };
+
+    static sys_commands_t crc_commands = {
+        .n_commands = sizeof(crc_command_list) / sizeof(sys_command_t),
+        .commands = crc_command_list
+    };
+
+    system_register_commands(&crc_commands);
+
+#endif
+}
+
+#endif // CRC_HOST
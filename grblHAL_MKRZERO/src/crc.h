@@ -0,0 +1,39 @@
+/*
+
+  crc.h - CRC32 (IEEE 802.3, as zlib crc32()) service
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _CRC_H_
+#define _CRC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32_update (uint32_t crc, const void *data, size_t length);
+
+static inline uint32_t crc32_compute (const void *data, size_t length)
+{
+    return crc32_update(0, data, length);
+}
+
+void crc_init (void);
+
+#endif
@@ -17,10 +17,14 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-
-#include <Arduino.h>
+#include <string.h>
 
 #include "diskio.h"
+#include "mcu_pins.h"
+#include "dma.h"
+#if USB_MSC_ENABLE
+#include "usb_msc.h"
+#endif
 
 /* Definitions for MMC/SDC command */
 #define CMD0    (0x40+0)    /* GO_IDLE_STATE */
@@ -57,15 +61,14 @@ typedef enum
     SPI_PAD_0_SCK_3
 } SercomSpiTXPad;
 
-#define pinIn(p) ((PORT->Group[g_APinDescription[p].ulPort].IN.reg & (1 << g_APinDescription[p].ulPin)) != 0)
-#define pinOut(p, e) { if(e) PORT->Group[g_APinDescription[p].ulPort].OUTSET.reg = (1 << g_APinDescription[p].ulPin); else PORT->Group[g_APinDescription[p].ulPort].OUTCLR.reg = (1 << g_APinDescription[p].ulPin); }
-
 #define SD_SCK_PIN  27
 #define SD_MOSI_PIN 26
 #define SD_CS_PIN   28
 #define SD_MISO_PIN 29
 #define SD_CLOCKMODE SERCOM_SPI_MODE_0
-#define SD_CLOCK_ID GCM_SERCOM4_CORE
+#define SD_CLOCK_ID GCLK_CLKCTRL_ID_SERCOM4_CORE_Val
+
+#define SD_DMAC_ID_TX SERCOM4_DMAC_ID_TX
 
 static Sercom *sd_spi = SERCOM4; // Alt mode C
 
@@ -75,7 +78,7 @@ static Sercom *sd_spi = SERCOM4; // Alt mode C
 #define SD_CS_PIN   6
 #define SD_MISO_PIN 10
 #define SD_CLOCKMODE SERCOM_SPI_MODE_0
-#define SD_CLOCK_ID GCM_SERCOM1_CORE
+#define SD_CLOCK_ID GCLK_CLKCTRL_ID_SERCOM1_CORE_Val
 
 static Sercom *sd_spi = SERCOM1; // Alt mode C
 */
@@ -112,6 +115,31 @@ BYTE CardType;            /* b0:MMC, b1:SDC, b2:Block addressing */
 static
 BYTE PowerFlag = 0;     /* indicates if "power" is on */
 
+static
+bool UsbOwned = false;  /* card is exposed to the USB host, FatFs access is blocked */
+
+/* Sequential writes are streamed as a single CMD25 multi-block write that is kept open
+ * between disk_write() calls. Blocks are copied to a double buffer and sent by DMA, the
+ * data response and the card busy period of a block are handled when the next block is
+ * sent or when the stream is closed. This way the card programs a block while the caller
+ * receives the next, e.g. a YModem upload packet.
+ * The stream is closed by any other disk operation, CTRL_SYNC included.
+ */
+
+#if _READONLY == 0
+
+static struct {
+    bool open;          /* CMD25 in progress, CS is asserted */
+    bool error;         /* a block sent by DMA was not accepted */
+    bool pending;       /* data response of the last block sent not yet checked */
+    volatile bool dma_busy;
+    uint_fast8_t buf;   /* next buffer to fill */
+    DWORD next;         /* next sector in sequence */
+    BYTE block[2][512 + 2] __attribute__((aligned(4))); /* data + dummy CRC */
+} wr_stream = {0};
+
+#endif
+
 /*-----------------------------------------------------------------------*/
 /* Transmit a byte to MMC via SPI  (Platform dependent)                  */
 /*-----------------------------------------------------------------------*/
@@ -167,6 +195,66 @@ BYTE wait_ready (void)
     return res;
 }
 
+/*-----------------------------------------------------------------------*/
+/* DMA block transmit for streamed writes                                */
+/*-----------------------------------------------------------------------*/
+
+#if _READONLY == 0
+
+static
+void sd_dma_complete (uint8_t channel, uint8_t flags)
+{
+    wr_stream.dma_busy = false;
+}
+
+/* Sends a data token and starts DMA transfer of a buffered block */
+static
+void xmit_datablock_dma (const BYTE *block)
+{
+    DmacDescriptor *desc = dma_descriptor(DMA_CHANNEL_SD_TX);
+
+    xmit_spi(0xFC);                     /* Multiple block write data token */
+
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID|DMAC_BTCTRL_BEATSIZE_BYTE|DMAC_BTCTRL_SRCINC|DMAC_BTCTRL_BLOCKACT_NOACT;
+    desc->BTCNT.reg = 512 + 2;
+    desc->SRCADDR.reg = (uint32_t)(block + 512 + 2); /* End address when incrementing */
+    desc->DSTADDR.reg = (uint32_t)&sd_spi->SPI.DATA.reg;
+    desc->DESCADDR.reg = 0;
+
+    wr_stream.pending = wr_stream.dma_busy = true;
+    dma_channel_enable(DMA_CHANNEL_SD_TX);
+}
+
+/* Waits for the DMA transfer to complete and checks the data response */
+static
+void wait_datablock_dma (void)
+{
+    BYTE resp;
+
+    if(!wr_stream.pending)
+        return;
+
+    wr_stream.pending = false;
+
+    Timer1 = 10;
+    while(wr_stream.dma_busy && Timer1);
+    while(!sd_spi->SPI.INTFLAG.bit.TXC);
+
+    /* Discard data clocked in during the transfer */
+    while(sd_spi->SPI.INTFLAG.bit.RXC)
+        (void)sd_spi->SPI.DATA.reg;
+    sd_spi->SPI.STATUS.reg = SERCOM_SPI_STATUS_BUFOVF;
+
+    resp = rcvr_spi();                  /* Receive data response */
+    if(wr_stream.dma_busy || (resp & 0x1F) != 0x05) {
+        dma_channel_disable(DMA_CHANNEL_SD_TX);
+        wr_stream.dma_busy = false;
+        wr_stream.error = true;
+    }
+}
+
+#endif /* _READONLY */
+
 /*-----------------------------------------------------------------------*/
 /* Send 80 or so clock transitions with CS and DI held high. This is     */
 /* required after card power up to get it into SPI mode                  */
@@ -205,10 +293,18 @@ void power_on (void)
         while(GCLK->STATUS.reg & GCLK_STATUS_SYNCBUSY);
  
         // Enable the peripherals used to drive the SDC on SSI
-        pinMode(SD_CS_PIN, OUTPUT);
-        pinPeripheral(SD_MISO_PIN, g_APinDescription[SD_MISO_PIN].ulPinType); // PIO_SERCOM
-        pinPeripheral(SD_SCK_PIN, g_APinDescription[SD_SCK_PIN].ulPinType);
-        pinPeripheral(SD_MOSI_PIN, g_APinDescription[SD_MOSI_PIN].ulPinType);
+        PIN_GROUP(SD_CS_PIN)->PINCFG[mcu_pin[SD_CS_PIN].pin].reg = (uint8_t)PORT_PINCFG_INEN;
+        PIN_GROUP(SD_CS_PIN)->DIRSET.reg = PIN_BIT(SD_CS_PIN);
+        pinMux(SD_MISO_PIN, PORT_PMUX_PMUXE_D_Val); // SERCOM4 PAD3
+        pinMux(SD_SCK_PIN, PORT_PMUX_PMUXE_D_Val);  // SERCOM4 PAD1
+        pinMux(SD_MOSI_PIN, PORT_PMUX_PMUXE_D_Val); // SERCOM4 PAD0
+
+#if _READONLY == 0
+        dma_init();
+        dma_channel_config(DMA_CHANNEL_SD_TX, SD_DMAC_ID_TX, 0, sd_dma_complete);
+        wr_stream.block[0][512] = wr_stream.block[0][513] = 0xFF;
+        wr_stream.block[1][512] = wr_stream.block[1][513] = 0xFF;
+#endif
 
         hal.delay_ms(1, NULL);
     }
@@ -349,6 +445,34 @@ BOOL xmit_datablock (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Close a streamed multiple block write                                 */
+/*-----------------------------------------------------------------------*/
+
+#if _READONLY == 0
+static
+BOOL close_write_stream (void)
+{
+    BOOL ok;
+
+    if(!wr_stream.open)
+        return TRUE;
+
+    wait_datablock_dma();
+    ok = !wr_stream.error && xmit_datablock(0, 0xFD);  /* STOP_TRAN token */
+    ok = wait_ready() == 0xFF && ok;
+
+    wr_stream.open = wr_stream.error = false;
+
+    DESELECT();            /* CS = H */
+    rcvr_spi();            /* Idle (Release DO) */
+
+    return ok;
+}
+#else
+#define close_write_stream() TRUE
+#endif
+
 /*-----------------------------------------------------------------------*/
 /* Send a command packet to MMC                                          */
 /*-----------------------------------------------------------------------*/
@@ -442,17 +566,15 @@ BYTE send_cmd12 (void)
 /* Initialize Disk Drive                                                 */
 /*-----------------------------------------------------------------------*/
 
-DSTATUS disk_initialize (
-    BYTE drv        /* Physical drive nmuber (0) */
-)
+static
+DSTATUS card_initialize (void)
 {
     BYTE n, ty, ocr[4];
 
 
-    pinOut(7, 1);
-    if (drv) return STA_NOINIT;            /* Supports only single drive */
     if (Stat & STA_NODISK) return Stat;    /* No card in the socket */
 
+    close_write_stream();
     power_on();                            /* Force socket power on */
     send_initial_clock_train();            /* Ensure the card is in SPI mode */
 
@@ -498,6 +620,17 @@ DSTATUS disk_initialize (
     return Stat;
 }
 
+DSTATUS disk_initialize (
+    BYTE drv        /* Physical drive nmuber (0) */
+)
+{
+    pinOut(7, 1);
+    if (drv) return STA_NOINIT;            /* Supports only single drive */
+    if (UsbOwned) return Stat | STA_NOINIT;
+
+    return card_initialize();
+}
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -509,9 +642,32 @@ DSTATUS disk_status (
 )
 {
     if (drv) return STA_NOINIT;        /* Supports only single drive */
-    return Stat;
+    return UsbOwned ? Stat | STA_NOINIT : Stat;
 }
 
+#if USB_MSC_ENABLE
+
+/*-----------------------------------------------------------------------*/
+/* Hand the card over to or back from the USB host                       */
+/*-----------------------------------------------------------------------*/
+/* disk_read(), disk_write() and disk_ioctl() are used by the USB mass   */
+/* storage class while claimed, FatFs sees the drive as not initialized. */
+/* On release the drive is flagged as not initialized so FatFs remounts  */
+/* the volume, the host may have changed it.                             */
+
+void disk_usb_claim (bool claim)
+{
+    close_write_stream();
+
+    if ((UsbOwned = claim)) {
+        if (Stat & STA_NOINIT)
+            card_initialize();
+    } else
+        Stat |= STA_NOINIT;
+}
+
+#endif
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -528,6 +684,8 @@ DRESULT disk_read (
     if (drv || !count) return RES_PARERR;
     if (Stat & STA_NOINIT) return RES_NOTRDY;
 
+    if (!close_write_stream()) return RES_ERROR;
+
     if (!(CardType & 4)) sector *= 512;    /* Convert to byte address if needed */
 
     SELECT();            /* CS = L */
@@ -571,31 +729,46 @@ DRESULT disk_write (
     if (Stat & STA_NOINIT) return RES_NOTRDY;
     if (Stat & STA_PROTECT) return RES_WRPRT;
 
-    if (!(CardType & 4)) sector *= 512;    /* Convert to byte address if needed */
+    if (wr_stream.open && sector != wr_stream.next && !close_write_stream())
+        return RES_ERROR;
 
-    SELECT();            /* CS = L */
+    if (!wr_stream.open) {
 
-    if (count == 1) {    /* Single block write */
-        if ((send_cmd(CMD24, sector) == 0)    /* WRITE_BLOCK */
-            && xmit_datablock(buff, 0xFE))
-            count = 0;
-    }
-    else {                /* Multiple block write */
-        if (CardType & 2) {
+        DWORD address = CardType & 4 ? sector : sector * 512;  /* Convert to byte address if needed */
+
+        SELECT();            /* CS = L */
+
+        /* Pre-erase only the blocks known to be written, the stream may be stopped early */
+        if ((CardType & 2) && count > 1) {
             send_cmd(CMD55, 0); send_cmd(CMD23, count);    /* ACMD23 */
         }
-        if (send_cmd(CMD25, sector) == 0) {    /* WRITE_MULTIPLE_BLOCK */
-            do {
-                if (!xmit_datablock(buff, 0xFC)) break;
-                buff += 512;
-            } while (--count);
-            if (!xmit_datablock(0, 0xFD))    /* STOP_TRAN token */
-                count = 1;
+
+        if (send_cmd(CMD25, address) != 0) {    /* WRITE_MULTIPLE_BLOCK */
+            DESELECT();            /* CS = H */
+            rcvr_spi();            /* Idle (Release DO) */
+            return RES_ERROR;
         }
+
+        wr_stream.open = true;
+        wr_stream.error = false;
     }
 
-    DESELECT();            /* CS = H */
-    rcvr_spi();            /* Idle (Release DO) */
+    wr_stream.next = sector + count;
+
+    do {
+        memcpy(wr_stream.block[wr_stream.buf], buff, 512);     /* Buffer while the previous block is sent */
+        wait_datablock_dma();
+        if (wr_stream.error || wait_ready() != 0xFF)
+            break;
+        xmit_datablock_dma(wr_stream.block[wr_stream.buf]);
+        wr_stream.buf ^= 1;
+        buff += 512;
+    } while (--count);
+
+    if (count) {
+        wr_stream.error = true;
+        close_write_stream();
+    }
 
     return count ? RES_ERROR : RES_OK;
 }
@@ -625,6 +798,7 @@ DRESULT disk_ioctl (
     if (ctrl == CTRL_POWER) {
         switch (*ptr) {
         case 0:        /* Sub control code == 0 (POWER_OFF) */
+            close_write_stream();
             if (chk_power())
                 power_off();        /* Power off */
             res = RES_OK;
@@ -644,6 +818,8 @@ DRESULT disk_ioctl (
     else {
         if (Stat & STA_NOINIT) return RES_NOTRDY;
 
+        if (!close_write_stream()) return RES_ERROR;
+
         SELECT();        /* CS = L */
 
         switch (ctrl) {
@@ -0,0 +1,141 @@
+/*
+
+  dma.c - DMA controller support for Atmel SAMD21 ARM processor
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if DMA_ENABLE
+
+#include <string.h>
+
+#include "dma.h"
+
+static DmacDescriptor descriptor[DMA_CHANNELS] __attribute__((aligned(16)));
+static volatile DmacDescriptor writeback[DMA_CHANNELS] __attribute__((aligned(16)));
+static dma_callback_ptr callback[DMA_CHANNELS] = {0};
+
+static void DMA_IRQHandler (void);
+
+void dma_init (void)
+{
+    static bool init_ok = false;
+
+    if(!init_ok) {
+
+        init_ok = true;
+
+        PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+        PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+
+        DMAC->CTRL.bit.DMAENABLE = 0;
+        DMAC->CTRL.bit.SWRST = 1;
+        while(DMAC->CTRL.bit.SWRST);
+
+        memset(descriptor, 0, sizeof(descriptor));
+        memset((void *)writeback, 0, sizeof(writeback));
+
+        DMAC->BASEADDR.reg = (uint32_t)descriptor;
+        DMAC->WRBADDR.reg = (uint32_t)writeback;
+        DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE|DMAC_CTRL_LVLEN(0xF);
+
+        IRQRegister(DMAC_IRQn, DMA_IRQHandler);
+
+        NVIC_SetPriority(DMAC_IRQn, 2);
+        NVIC_EnableIRQ(DMAC_IRQn);
+    }
+}
+
+DmacDescriptor *dma_descriptor (uint8_t channel)
+{
+    return &descriptor[channel];
+}
+
+// Resets and configures a channel, transfers are triggered by a single beat per trigger
+void dma_channel_config (uint8_t channel, uint8_t trigger, uint8_t priority, dma_callback_ptr handler)
+{
+    __disable_irq();
+
+    DMAC->CHID.reg = DMAC_CHID_ID(channel);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    while(DMAC->CHCTRLA.bit.SWRST);
+
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(priority)|DMAC_CHCTRLB_TRIGSRC(trigger)|DMAC_CHCTRLB_TRIGACT_BEAT;
+
+    if((callback[channel] = handler))
+        DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL|DMAC_CHINTENSET_TERR;
+    else
+        DMAC->CHINTENCLR.reg = DMAC_CHINTENCLR_TCMPL|DMAC_CHINTENCLR_TERR|DMAC_CHINTENCLR_SUSP;
+
+    __enable_irq();
+}
+
+void dma_channel_enable (uint8_t channel)
+{
+    __disable_irq();
+
+    DMAC->CHID.reg = DMAC_CHID_ID(channel);
+    DMAC->CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+
+    __enable_irq();
+}
+
+void dma_channel_disable (uint8_t channel)
+{
+    __disable_irq();
+
+    DMAC->CHID.reg = DMAC_CHID_ID(channel);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+    while(DMAC->CHCTRLA.bit.ENABLE);
+
+    __enable_irq();
+}
+
+// Returns number of beats remaining of a block transfer, only valid when the channel is suspended or disabled
+uint16_t dma_remaining (uint8_t channel)
+{
+    return writeback[channel].BTCNT.reg;
+}
+
+static void DMA_IRQHandler (void)
+{
+    uint8_t channel, flags;
+    uint32_t status;
+
+    while((status = DMAC->INTSTATUS.reg)) {
+
+        channel = 0;
+        while(!(status & 0x01)) {
+            channel++;
+            status >>= 1;
+        }
+
+        DMAC->CHID.reg = DMAC_CHID_ID(channel);
+        flags = DMAC->CHINTFLAG.reg;
+        DMAC->CHINTFLAG.reg = flags;
+
+        if(channel < DMA_CHANNELS && callback[channel])
+            callback[channel](channel, flags);
+    }
+}
+
+#endif // DMA_ENABLE
@@ -0,0 +1,47 @@
+/*
+
+  dma.h - DMA controller support for Atmel SAMD21 ARM processor
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _DMA_H_
+#define _DMA_H_
+
+#include "driver.h"
+
+// DMA channel assignments
+
+#define DMA_CHANNEL_ADC         0
+#define DMA_CHANNEL_MODBUS_TX   1
+#define DMA_CHANNEL_MODBUS_RX   2
+#define DMA_CHANNEL_SD_TX       3
+
+#define DMA_CHANNELS            4 // Highest channel in use + 1, the descriptor table is sized accordingly
+
+typedef void (*dma_callback_ptr)(uint8_t channel, uint8_t flags);
+
+void dma_init (void);
+DmacDescriptor *dma_descriptor (uint8_t channel);
+void dma_channel_config (uint8_t channel, uint8_t trigger, uint8_t priority, dma_callback_ptr callback);
+void dma_channel_enable (uint8_t channel);
+void dma_channel_disable (uint8_t channel);
+uint16_t dma_remaining (uint8_t channel);
+
+#endif
@@ -21,27 +21,92 @@
 
 */
 
-#include "Arduino.h"
+#include <string.h>
 
 #include "driver.h"
 #include "serial.h"
+#include "mcu_pins.h"
 
 #include "grbl/machine_limits.h"
 #include "grbl/state_machine.h"
+#include "grbl/protocol.h"
+#include "grbl/nuts_bolts.h"
+#if STEP_ISR_OVERRUN_ALARM
+#include "grbl/motion_control.h"
+#endif
+#if AMASS_ADAPTIVE
+#include "grbl/stepper.h"
+#include "grbl/planner.h"
+#include "grbl/report.h"
+#endif
 
 #if USB_SERIAL_CDC
 #include "usb_serial.h"
 #endif
 
+#include "crc.h"
+
 #if SDCARD_ENABLE
 #include "sdcard/sdcard.h"
 #include "diskio.h"
 #endif
 
+#if SDJOB_ENABLE
+#include "sdjob.h"
+#endif
+
+#if USB_MSC_ENABLE
+#include "usb_msc.h"
+#endif
+
 #if IOEXPAND_ENABLE
 #include "ioexpand.h"
 #endif
 
+#if ANALOG_ENABLE
+#include "analog.h"
+#endif
+
+#if ADAPTIVE_FEED_ENABLE
+#include "adaptive_feed.h"
+#endif
+
+#if POWERFAIL_ENABLE
+#include "powerfail.h"
+#endif
+
+#if TELEMETRY_ENABLE
+#include "telemetry.h"
+#endif
+
+#if STEPTEST_ENABLE
+#include "steptest.h"
+#endif
+
+#if BACKLASH_ENABLE
+#include "backlash.h"
+#endif
+
+#if SPINDLE_SYNC_ENABLE
+#include "spindle_sync.h"
+#endif
+
+#if RASTER_ENABLE
+#include "raster.h"
+#endif
+
+#if LASER_PPI_ENABLE
+#include "ppi.h"
+#endif
+
+#if THC_ENABLE
+#include "thc.h"
+#endif
+
+#if VFD_ENABLE
+#include "vfd_spindle.h"
+#endif
+
 #if EEPROM_ENABLE
 #include "eeprom/eeprom.h"
 #endif
@@ -64,7 +129,34 @@ static gpio_t spindleEnable, spindleDir, steppersEnable, Mist, Flood;
 static gpio_t Led;
 #endif
 
-#define pinIn(p) ((PORT->Group[g_APinDescription[p].ulPort].IN.reg & (1 << g_APinDescription[p].ulPin)) != 0)
+#if AUX_OUTPUTS_ENABLE
+
+static const uint8_t aux_out_pin[] = {
+#ifdef AUXOUTPUT0_PIN
+    AUXOUTPUT0_PIN,
+#endif
+#ifdef AUXOUTPUT1_PIN
+    AUXOUTPUT1_PIN,
+#endif
+#ifdef AUXOUTPUT2_PIN
+    AUXOUTPUT2_PIN,
+#endif
+#ifdef AUXOUTPUT3_PIN
+    AUXOUTPUT3_PIN,
+#endif
+};
+
+#define N_AUX_OUT (sizeof(aux_out_pin) / sizeof(uint8_t))
+
+static gpio_t aux_out[N_AUX_OUT];
+static volatile bool in_stepper_isr = false;
+static volatile struct {
+    uint8_t pending;
+    uint8_t value;
+} aux_latch = {0};
+
+#endif
+
 #define DIGITAL_OUT(gpio, on) { if(on) gpio.port->OUTSET.reg = gpio.bit; else gpio.port->OUTCLR.reg = gpio.bit; }
 
 uint32_t vectorTable[sizeof(DeviceVectors) / sizeof(uint32_t)] __attribute__(( aligned (0x100ul) ));
@@ -73,6 +165,8 @@ uint32_t vectorTable[sizeof(DeviceVectors) / sizeof(uint32_t)] __attribute__(( a
 static uint16_t pulse_length, pulse_delay;
 static bool IOInitDone = false;
 static bool sd_detect = false;
+static volatile uint32_t elapsed_ticks = 0;
+static void (*eic_handler[16])(void) = {0};
 static axes_signals_t next_step_outbits;
 static delay_t delay_ms = { .ms = 1, .callback = NULL }; // NOTE: initial ms set to 1 for "resetting" systick timer on startup
 static probe_state_t probe = {
@@ -89,17 +183,74 @@ static spindle_pwm_t spindle_pwm;
 static ioexpand_t iopins = {0};
 #endif
 static axes_signals_t limit_ies; // declare here for now...
+#if DETERMINISTIC_TIMING || STEP_ISR_MONITOR
+static volatile struct {
+    uint32_t min;
+    uint32_t max;
+    uint32_t samples;
+#if STEP_ISR_MONITOR
+    uint64_t total;         // sum of latencies, for the mean
+    uint32_t overruns;      // ticks where the next compare match occurred before the handler completed
+    uint32_t load;          // leaky bucket, incremented by 16 on overrun and decremented by 1 otherwise
+#endif
+} isr_timing = { .min = UINT32_MAX };
+#endif
+#if STEP_INTERPOLATION
+// The reload value is ramped from the current to the new segment value over 2^STEP_INTERPOLATION ticks.
+// Not done across AMASS level changes as the tick rate then changes in steps.
+static struct {
+    stepper_t *stepper;         // core stepper state, captured on pulse start
+    uint32_t current;           // reload value in use, 0 when stopped
+    uint32_t target;            // reload value of the segment being executed
+    int32_t delta;              // change per tick while ramping
+    uint_fast8_t ticks;         // ramp ticks remaining
+#ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+    uint_fast8_t amass_level;
+#endif
+} interp = {0};
+#endif
+#if AMASS_ADAPTIVE
+// The stepper interrupt cost is sampled every 16th tick as a decaying peak. It is used for limiting the tick rate
+// to what the interrupt can sustain and for selecting the AMASS level and tick period limit when motion stops.
+// The core latches the AMASS thresholds on reset so a new level is applied by a stepper reset from the foreground
+// when idle with the planner empty.
+#define AMASS_TICK_RATE_MAX 16000 // Hz, max tick rate AMASS runs the stepper interrupt at, the same for all levels
+static struct {
+    uint32_t cost;              // timer ticks from compare match to interrupt exit
+    uint32_t min_cycles;        // tick period floor, 0 until measured
+    uint32_t max_cycles;        // tick period limit
+    uint32_t capped;            // segments limited by the tick period floor
+    uint_fast8_t level;         // level to apply
+    uint_fast8_t sample;
+    bool pending;               // foreground task queued
+    bool cap_reported;
+} amass = { .max_cycles = (1UL << 18) - 1UL, .level = 3 };
+#endif
+#if STEP_DUAL_EDGE
+// PORT OUTTGL masks for PORTA and PORTB indexed by the step bits, set up by driver_setup()
+static struct {
+    uint32_t a;
+    uint32_t b;
+} step_toggle[8] = {0};
+#endif
 
 static void SysTick_IRQHandler (void);
 static void STEPPER_IRQHandler (void);
 static void STEPPULSE_IRQHandler (void);
 static void STEPPULSE_Delayed_IRQHandler (void);
+#if STEP_DUAL_EDGE
+static void STEPPULSE_DualEdge_IRQHandler (void);
+#endif
 static void LIMIT_IRQHandler (void);
 static void CONTROL_IRQHandler (void);
 static void DEBOUNCE_IRQHandler (void);
 static void SD_IRQHandler (void);
+static void EIC_IRQHandler (void);
 
 extern void Dummy_Handler(void);
+#if !BARE_METAL
+extern void init(void);
+#endif
 
 #if I2C_STROBE_ENABLE
 
@@ -127,6 +278,28 @@ void IRQUnRegister(int32_t IRQnum)
     vectorTable[IRQnum + 16] = (uint32_t)Dummy_Handler;
 }
 
+static uint32_t getElapsedTicks (void)
+{
+    return elapsed_ticks;
+}
+
+static uint32_t getMicros (void)
+{
+    uint32_t ms, ticks, pending;
+
+    do {
+        ms = elapsed_ticks;
+        ticks = SysTick->VAL;
+        pending = SCB->ICSR & SCB_ICSR_PENDSTSET_Msk;
+    } while(ms != elapsed_ticks);
+
+    // Account for a SysTick reload not yet serviced, e.g. when called with interrupts disabled
+    if(pending && ticks > (SysTick->LOAD >> 1))
+        ms++;
+
+    return ms * 1000 + (SysTick->LOAD - ticks) / (SystemCoreClock / 1000000);
+}
+
 static void driver_delay_ms (uint32_t ms, void (*callback)(void))
 {
     if((delay_ms.ms = ms) > 0) {
@@ -139,21 +312,163 @@ static void driver_delay_ms (uint32_t ms, void (*callback)(void))
         callback();
 }
 
+void pinModeOutput (gpio_t *gpio, uint8_t pin)
+{
+    gpio->port = PIN_GROUP(pin);
+    gpio->bit = PIN_BIT(pin);
+    gpio->port->PINCFG[mcu_pin[pin].pin].reg = (uint8_t)PORT_PINCFG_INEN; // Input enabled for output state readback
+    gpio->port->DIRSET.reg = gpio->bit;
+}
+
+static void pinModeInput (uint8_t pin, bool pull_up)
+{
+    PortGroup *port = PIN_GROUP(pin);
+
+    port->DIRCLR.reg = PIN_BIT(pin);
+    port->PINCFG[mcu_pin[pin].pin].reg = (uint8_t)(PORT_PINCFG_INEN|PORT_PINCFG_PULLEN);
+    if(pull_up)
+        port->OUTSET.reg = PIN_BIT(pin);
+    else
+        port->OUTCLR.reg = PIN_BIT(pin);
+}
+
+// Returns true if pin is an input with the given pull direction
+static inline bool pinPullMatch (uint8_t pin, bool pull_up)
+{
+    PortGroup *port = PIN_GROUP(pin);
+
+    return port->PINCFG[mcu_pin[pin].pin].bit.PULLEN && !!(port->OUT.reg & PIN_BIT(pin)) == pull_up;
+}
+
+// Updates pull and interrupt edge of an input if changed, interrupt enable is left as is.
+// Returns the EXTINT line bit if the input was changed, pull_changed is set if the pull was changed.
+static uint32_t pinInputUpdate (uint8_t pin, bool pull_up, uint32_t sense, void (*handler)(void), bool *pull_changed)
+{
+    bool changed = false;
+    uint32_t extint = mcu_pin[pin].extint;
+
+    if(!pinPullMatch(pin, pull_up)) {
+        PortGroup *port = PIN_GROUP(pin);
+        if(port->PINCFG[mcu_pin[pin].pin].bit.PULLEN) {
+            // Already configured, only flip the pull direction
+            if(pull_up)
+                port->OUTSET.reg = PIN_BIT(pin);
+            else
+                port->OUTCLR.reg = PIN_BIT(pin);
+        } else {
+            pinModeInput(pin, pull_up);
+            if(extint != NO_EXTINT)
+                pinMux(pin, PORT_PMUX_PMUXE_A_Val);
+        }
+        *pull_changed = changed = true;
+    }
+
+    if(extint == NO_EXTINT)
+        return 0;
+
+    uint32_t shift = (extint & 0x07) << 2, config = EIC->CONFIG[extint >> 3].reg;
+
+    if(((config >> shift) & EIC_CONFIG_SENSE0_Msk) != sense) {
+        EIC->CONFIG[extint >> 3].reg = (config & ~(EIC_CONFIG_SENSE0_Msk << shift)) | (sense << shift);
+        changed = true;
+    }
+
+    eic_handler[extint] = handler;
+
+    return changed ? (1 << extint) : 0;
+}
+
+// Routes pin to the external interrupt controller, sense is one of the EIC_CONFIG_SENSE0_xxx_Val values
+// NOTE: pins sharing an EXTINT line cannot both be used, the last one enabled wins.
+static void pinIRQEnable (uint8_t pin, uint32_t sense, void (*handler)(void))
+{
+    uint32_t extint = mcu_pin[pin].extint, shift = (extint & 0x07) << 2;
+
+    if(extint == NO_EXTINT)
+        return;
+
+    EIC->INTENCLR.reg = 1 << extint;
+    eic_handler[extint] = handler;
+    EIC->CONFIG[extint >> 3].reg = (EIC->CONFIG[extint >> 3].reg & ~(EIC_CONFIG_SENSE0_Msk << shift)) | (sense << shift);
+    pinMux(pin, PORT_PMUX_PMUXE_A_Val);
+    EIC->INTFLAG.reg = 1 << extint;
+    EIC->INTENSET.reg = 1 << extint;
+}
+
+static void pinIRQDisable (uint8_t pin)
+{
+    if(mcu_pin[pin].extint != NO_EXTINT)
+        EIC->INTENCLR.reg = 1 << mcu_pin[pin].extint;
+}
+
+#if AUX_OUTPUTS_ENABLE
+
+// Writes output changes latched by the stepper interrupt handler
+static inline __attribute__((always_inline)) void aux_out_latched (void)
+{
+    uint_fast8_t idx = N_AUX_OUT, pending = aux_latch.pending;
+
+    aux_latch.pending = 0;
+
+    do {
+        idx--;
+        if(pending & (1 << idx))
+            DIGITAL_OUT(aux_out[idx], aux_latch.value & (1 << idx));
+    } while(idx);
+}
+
+#endif
+
 // Set stepper pulse output pins
 static inline __attribute__((always_inline)) void set_step_outputs (axes_signals_t step_outbits)
 {
     step_outbits.value ^= settings.steppers.step_invert.mask;
 
+#if BACKLASH_ENABLE // Outputs of axes with backlash steps being injected are owned by the injector
+    if(backlash_injecting.value) {
+        if(!backlash_injecting.x)
+            DIGITAL_OUT(stepX, step_outbits.x);
+        if(!backlash_injecting.y)
+            DIGITAL_OUT(stepY, step_outbits.y);
+        if(!backlash_injecting.z)
+            DIGITAL_OUT(stepZ, step_outbits.z);
+        return;
+    }
+#endif
+
     DIGITAL_OUT(stepX, step_outbits.x);
     DIGITAL_OUT(stepY, step_outbits.y);
     DIGITAL_OUT(stepZ, step_outbits.z);
 }
 
+#if STEP_DUAL_EDGE
+
+// Toggle stepper pulse output pins, each toggle is a step for drivers stepping on both edges
+static inline __attribute__((always_inline)) void toggle_step_outputs (axes_signals_t step_outbits)
+{
+    PORT->Group[0].OUTTGL.reg = step_toggle[step_outbits.value & 0x07].a;
+    PORT->Group[1].OUTTGL.reg = step_toggle[step_outbits.value & 0x07].b;
+}
+
+#endif
+
 // Set stepper direction output pins
 static inline __attribute__((always_inline)) void set_dir_outputs (axes_signals_t dir_outbits)
 {
     dir_outbits.value ^= settings.steppers.dir_invert.mask;
 
+#if BACKLASH_ENABLE // Outputs of axes with backlash steps being injected are owned by the injector
+    if(backlash_injecting.value) {
+        if(!backlash_injecting.x)
+            DIGITAL_OUT(dirX, dir_outbits.x);
+        if(!backlash_injecting.y)
+            DIGITAL_OUT(dirY, dir_outbits.y);
+        if(!backlash_injecting.z)
+            DIGITAL_OUT(dirZ, dir_outbits.z);
+        return;
+    }
+#endif
+
     DIGITAL_OUT(dirX, dir_outbits.x);
     DIGITAL_OUT(dirY, dir_outbits.y);
     DIGITAL_OUT(dirZ, dir_outbits.z);
@@ -178,12 +493,45 @@ static void stepperEnable (axes_signals_t enable, bool hold)
 // Sets up stepper driver interrupt timeout, AMASS version
 static void stepperCyclesPerTick (uint32_t cycles_per_tick)
 {
+#if SPINDLE_SYNC_ENABLE
+    cycles_per_tick = spindle_sync_cycles(cycles_per_tick);
+#endif
+
 // Limit min steps/s to about 2 (hal.f_step_timer @ 20MHz)
-#ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    STEPPER_TIMER->COUNT32.CC[0].reg = cycles_per_tick < (1UL << 18) ? cycles_per_tick : (1UL << 18) - 1UL;
+#if AMASS_ADAPTIVE
+    cycles_per_tick = cycles_per_tick < amass.max_cycles ? cycles_per_tick : amass.max_cycles;
+    if(cycles_per_tick < amass.min_cycles) {
+        cycles_per_tick = amass.min_cycles;
+        amass.capped++;
+    }
+#elif defined(ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING)
+    cycles_per_tick = cycles_per_tick < (1UL << 18) ? cycles_per_tick : (1UL << 18) - 1UL;
 #else
-    STEPPER_TIMER->COUNT32.CC[0].reg = cycles_per_tick < (1UL << 23) ? cycles_per_tick : (1UL << 23) - 1UL;
+    cycles_per_tick = cycles_per_tick < (1UL << 23) ? cycles_per_tick : (1UL << 23) - 1UL;
 #endif
+
+#if STEP_INTERPOLATION
+    bool ramp = interp.current != 0;
+
+  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+    if(interp.stepper && interp.stepper->exec_segment) {
+        ramp = ramp && interp.stepper->exec_segment->amass_level == interp.amass_level;
+        interp.amass_level = interp.stepper->exec_segment->amass_level;
+    }
+  #endif
+
+    // Ramped from the stepper interrupt, the shift replaces a division by the number of ramp ticks
+    if(ramp && (interp.delta = ((int32_t)cycles_per_tick - (int32_t)interp.current) >> STEP_INTERPOLATION)) {
+        interp.target = cycles_per_tick;
+        interp.ticks = 1 << STEP_INTERPOLATION;
+        return;
+    }
+
+    interp.ticks = 0;
+    interp.current = interp.target = cycles_per_tick;
+#endif
+
+    STEPPER_TIMER->COUNT32.CC[0].reg = cycles_per_tick;
     while(STEPPER_TIMER->COUNT32.STATUS.bit.SYNCBUSY);
 }
 
@@ -201,24 +549,104 @@ static void stepperWakeUp (void)
     STEP_TIMER->COUNT16.CTRLA.reg |= TC_CTRLA_ENABLE;
     while(STEP_TIMER->COUNT16.STATUS.bit.SYNCBUSY);
 
+#if STEP_INTERPOLATION
+    interp.current = 0;
+#endif
+
     stepperCyclesPerTick(hal.f_step_timer / 500);   // start the show
 }
 
+#if AMASS_ADAPTIVE
+
+// Applies a new AMASS level via a stepper reset so the core picks up the thresholds for it,
+// retried on the next stop if not idle. Also reports feed rates capped by the tick period floor.
+static void amass_apply (void *data)
+{
+    amass.pending = false;
+
+    if(amass.capped && !amass.cap_reported) {
+        amass.cap_reported = true;
+        report_message("Feed rate limited by stepper interrupt load, see $AMASS", Message_Warning);
+    }
+
+    if(amass.level != hal.driver_cap.amass_level && state_get() == STATE_IDLE && plan_get_current_block() == NULL) {
+        hal.driver_cap.amass_level = amass.level;
+        amass.max_cycles = amass.level ? (1UL << 18) - 1UL : (1UL << 23) - 1UL;
+        st_reset();
+    }
+}
+
+// Keep the tick rate below 80% of the measured interrupt capacity, use the highest AMASS level
+// if the interrupt can sustain the max AMASS tick rate and disable AMASS if not.
+static void amass_adapt (void)
+{
+    if(amass.cost) {
+        amass.min_cycles = amass.cost + (amass.cost >> 2);
+        amass.level = hal.f_step_timer / AMASS_TICK_RATE_MAX >= amass.min_cycles ? 3 : 0;
+        if(!amass.pending && (amass.level != hal.driver_cap.amass_level || (amass.capped && !amass.cap_reported)))
+            amass.pending = protocol_enqueue_foreground_task(amass_apply, NULL);
+    }
+}
+
+#endif
+
 // Disables stepper driver interrupts
 static void stepperGoIdle (bool clear_signals)
 {
     STEPPER_TIMER->COUNT32.CTRLBSET.reg = TC_CTRLBCLR_CMD_STOP;
     while(STEPPER_TIMER->COUNT32.STATUS.bit.SYNCBUSY);
 
+#if AMASS_ADAPTIVE
+    amass_adapt();
+#endif
+
+#if SPINDLE_SYNC_ENABLE
+    spindle_sync_stop();
+#endif
+
+#if AUX_OUTPUTS_ENABLE
+    if(aux_latch.pending)
+        aux_out_latched();
+#endif
+
     if(clear_signals) {
+#if BACKLASH_ENABLE // Called with clear_signals set by the core on reset
+        backlash_stop();
+#endif
+#if !STEP_DUAL_EDGE // Changing the step outputs would output a step
         set_step_outputs((axes_signals_t){0});
+#endif
         set_dir_outputs((axes_signals_t){0});
     }
 }
 
+// Runs the optional plugin hooks, called first by all pulse start variants.
+// THC injection runs before backlash so injected reversals are compensated.
+static inline __attribute__((always_inline)) void pulse_start_hooks (stepper_t *stepper)
+{
+#if STEP_INTERPOLATION
+    interp.stepper = stepper;
+#endif
+#if THC_ENABLE
+    thc_pulse_start(stepper);
+#endif
+// Raster and PPI count the core's steps, called before backlash compensation removes absorbed steps on reversal
+#if RASTER_ENABLE
+    raster_pulse_start(stepper);
+#endif
+#if LASER_PPI_ENABLE
+    ppi_pulse_start(stepper);
+#endif
+#if BACKLASH_ENABLE
+    backlash_pulse_start(stepper);
+#endif
+}
+
 // Sets stepper direction and pulse pins and starts a step pulse
-static void stepperPulseStart (stepper_t *stepper)
+static void RAMFUNC stepperPulseStart (stepper_t *stepper)
 {
+    pulse_start_hooks(stepper);
+
     if(stepper->dir_change)
         set_dir_outputs(stepper->dir_outbits);
 
@@ -230,8 +658,10 @@ static void stepperPulseStart (stepper_t *stepper)
 
 // Start a stepper pulse, delay version.
 // Note: delay is only added when there is a direction change and a pulse to be output.
-static void stepperPulseStartDelayed (stepper_t *stepper)
+static void RAMFUNC stepperPulseStartDelayed (stepper_t *stepper)
 {
+    pulse_start_hooks(stepper);
+
     if(stepper->dir_change) {
 
         set_dir_outputs(stepper->dir_outbits);
@@ -256,25 +686,62 @@ static void stepperPulseStartDelayed (stepper_t *stepper)
     }
 }
 
+#if STEP_DUAL_EDGE
+
+// Sets stepper direction pins and toggles the step pins, no pulse end interrupt is needed.
+static void RAMFUNC stepperPulseStartDualEdge (stepper_t *stepper)
+{
+    pulse_start_hooks(stepper);
+
+    if(stepper->dir_change)
+        set_dir_outputs(stepper->dir_outbits);
+
+    if(stepper->step_outbits.value)
+        toggle_step_outputs(stepper->step_outbits);
+}
+
+// Dual edge version of stepperPulseStartDelayed, the step timer is only armed for the direction setup delay.
+static void RAMFUNC stepperPulseStartDualEdgeDelayed (stepper_t *stepper)
+{
+    pulse_start_hooks(stepper);
+
+    if(stepper->dir_change) {
+
+        set_dir_outputs(stepper->dir_outbits);
+
+        if(stepper->step_outbits.value) {
+            next_step_outbits = stepper->step_outbits; // Store out_bits
+            STEP_TIMER->COUNT16.CTRLBSET.reg = TC_CTRLBCLR_CMD_RETRIGGER|TCC_CTRLBSET_ONESHOT;
+        }
+
+        return;
+    }
+
+    if(stepper->step_outbits.value)
+        toggle_step_outputs(stepper->step_outbits);
+}
+
+#endif
+
 // Enable/disable limit pins interrupt
 static void limitsEnable (bool on, axes_signals_t homing_cycle)
 {
     on = on && homing_cycle.mask == 0;
 
     if(on && !homing_cycle.x)
-        attachInterrupt(X_LIMIT_PIN, LIMIT_IRQHandler, limit_ies.x ? FALLING : RISING);
+        pinIRQEnable(X_LIMIT_PIN, limit_ies.x ? EIC_CONFIG_SENSE0_FALL_Val : EIC_CONFIG_SENSE0_RISE_Val, LIMIT_IRQHandler);
     else
-        detachInterrupt(X_LIMIT_PIN);
+        pinIRQDisable(X_LIMIT_PIN);
 
     if(on && !homing_cycle.y)
-        attachInterrupt(Y_LIMIT_PIN, LIMIT_IRQHandler, limit_ies.y ? FALLING : RISING);
+        pinIRQEnable(Y_LIMIT_PIN, limit_ies.y ? EIC_CONFIG_SENSE0_FALL_Val : EIC_CONFIG_SENSE0_RISE_Val, LIMIT_IRQHandler);
     else
-        detachInterrupt(Y_LIMIT_PIN);
+        pinIRQDisable(Y_LIMIT_PIN);
 
     if(on && !homing_cycle.z)
-        attachInterrupt(Z_LIMIT_PIN, LIMIT_IRQHandler, limit_ies.z ? FALLING : RISING);
+        pinIRQEnable(Z_LIMIT_PIN, limit_ies.z ? EIC_CONFIG_SENSE0_FALL_Val : EIC_CONFIG_SENSE0_RISE_Val, LIMIT_IRQHandler);
     else
-        detachInterrupt(Z_LIMIT_PIN);
+        pinIRQDisable(Z_LIMIT_PIN);
 }
 
 // Returns limit state as an axes_signals_t variable.
@@ -415,6 +882,10 @@ static void spindleSetSpeed (spindle_ptrs_t *spindle, uint_fast16_t pwm_value)
             else
                 spindle_off();
         }
+#if LASER_PPI_ENABLE
+        if(ppi_arm(false))
+            return;
+#endif
         if(spindle->context.pwm->flags.always_on) {
             SPINDLE_PWM_TIMER->CC[SPINDLE_PWM_CCREG].bit.CC = spindle->context.pwm->off_value;
             while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.CC2);
@@ -432,6 +903,10 @@ static void spindleSetSpeed (spindle_ptrs_t *spindle, uint_fast16_t pwm_value)
                 spindle_on();
             pwmEnabled = true;
         }
+#if LASER_PPI_ENABLE
+        if(ppi_arm(true))
+            return;
+#endif
         SPINDLE_PWM_TIMER->CC[SPINDLE_PWM_CCREG].bit.CC = pwm_value;
         while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.CC2);
         SPINDLE_PWM_TIMER->CTRLBSET.bit.CMD = TCC_CTRLBCLR_CMD_RETRIGGER_Val;
@@ -487,6 +962,9 @@ bool spindleConfig (spindle_ptrs_t *spindle)
         while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.CC2);
         SPINDLE_PWM_TIMER->CTRLA.bit.ENABLE = 1;
         while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.ENABLE);
+#if LASER_PPI_ENABLE
+        ppi_configure();
+#endif
         spindle->set_state = spindleSetStateVariable;
     } else {
         if(pwmEnabled)
@@ -572,6 +1050,58 @@ static coolant_state_t coolantGetState (void)
     return state;
 }
 
+#if AUX_OUTPUTS_ENABLE
+
+// Sets an auxiliary output.
+// When called from the stepper interrupt, i.e. for motion synchronized output commands (M62/M63),
+// the change is latched and written at the next step interrupt together with the first step of the new segment.
+static void digitalOut (uint8_t port, bool on)
+{
+    if(port < N_AUX_OUT) {
+
+        on = ((settings.ioport.invert_out.mask >> port) & 0x01) ? !on : on;
+
+        if(in_stepper_isr) {
+            if(on)
+                aux_latch.value |= (1 << port);
+            else
+                aux_latch.value &= ~(1 << port);
+            aux_latch.pending |= (1 << port);
+        } else {
+            __disable_irq();
+            aux_latch.pending &= ~(1 << port);
+            DIGITAL_OUT(aux_out[port], on);
+            __enable_irq();
+        }
+    }
+}
+
+#endif
+
+#if ANALOG_ENABLE
+
+// Analog inputs are continuously sampled by DMA, no need to wait.
+static int32_t waitOnInput (io_port_type_t type, uint8_t port, wait_mode_t wait_mode, float timeout)
+{
+    int32_t value = -1;
+
+    if(type == Port_Analog && port < analog_channels())
+        value = (int32_t)analog_read(port);
+
+    return value;
+}
+
+#ifdef ANALOG_FEED_HOLD_CHANNEL
+
+static void analogFeedHold (uint8_t channel, uint16_t value)
+{
+    protocol_enqueue_realtime_command(CMD_FEED_HOLD);
+}
+
+#endif
+
+#endif // ANALOG_ENABLE
+
 // Helper functions for setting/clearing/inverting individual bits atomically (uninterruptable)
 static void bitsSetAtomic (volatile uint_fast16_t *ptr, uint_fast16_t bits)
 {
@@ -598,13 +1128,113 @@ static uint_fast16_t valueSetAtomic (volatile uint_fast16_t *ptr, uint_fast16_t
     return prev;
 }
 
-void pinModeOutput (gpio_t *gpio, uint8_t pin)
+static void report_tx_lane (const char *lane, const tx_lane_stats_t *stats)
+{
+    hal.stream.write("[TXQ:");
+    hal.stream.write(lane);
+    hal.stream.write(",");
+    hal.stream.write(uitoa(stats->lines));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(stats->bytes));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(stats->waits));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(stats->peak));
+    hal.stream.write("]" ASCII_EOL);
+}
+
+// Reports output queue statistics per lane: lines, bytes, waits for free space and peak bytes queued
+static status_code_t tx_stats_command (sys_state_t state, char *args)
+{
+#if USB_SERIAL_CDC
+    const tx_stats_t *stats = usbTxStats();
+#else
+    const tx_stats_t *stats = serialTxStats();
+#endif
+
+    report_tx_lane("PRI", &stats->priority);
+    report_tx_lane("BULK", &stats->bulk);
+
+    return Status_OK;
+}
+
+#if AMASS_ADAPTIVE
+
+// Reports the selected AMASS level, stepper interrupt cost in ns, max tick rate in Hz
+// and number of segments capped by the max tick rate since last report
+static status_code_t amass_command (sys_state_t state, char *args)
 {
-    pinMode(pin, OUTPUT);
-    gpio->port = (PortGroup *)&PORT->Group[g_APinDescription[pin].ulPort].DIR.reg;
-    gpio->bit = 1 << g_APinDescription[pin].ulPin;
+    if(args)
+        return Status_InvalidStatement;
+
+    hal.stream.write("[AMASS:");
+    hal.stream.write(uitoa(hal.driver_cap.amass_level));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(amass.cost * 125 / 2)); // 16 MHz ticks to ns
+    hal.stream.write(",");
+    hal.stream.write(uitoa(amass.min_cycles ? hal.f_step_timer / amass.min_cycles : 0));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(amass.capped));
+    hal.stream.write("]" ASCII_EOL);
+
+    amass.capped = 0;
+    amass.cap_reported = false;
+
+    return Status_OK;
 }
 
+#endif
+
+#if DETERMINISTIC_TIMING || STEP_ISR_MONITOR
+
+// Reports stepper interrupt entry latency in ns, $ISR=0 resets the statistics
+static status_code_t isr_timing_command (sys_state_t state, char *args)
+{
+    if(args) {
+        if(!(*args == '0' && args[1] == '\0'))
+            return Status_InvalidStatement;
+        __disable_irq();
+        isr_timing.min = UINT32_MAX;
+        isr_timing.max = isr_timing.samples = 0;
+#if STEP_ISR_MONITOR
+        isr_timing.total = 0;
+        isr_timing.overruns = isr_timing.load = 0;
+#endif
+        __enable_irq();
+    } else {
+        __disable_irq();
+        uint32_t min = isr_timing.min, max = isr_timing.max, samples = isr_timing.samples;
+#if STEP_ISR_MONITOR
+        uint64_t total = isr_timing.total;
+        uint32_t overruns = isr_timing.overruns;
+#endif
+        __enable_irq();
+        hal.stream.write("[ISR:");
+        if(samples) {
+            hal.stream.write(uitoa(min * 125 / 2)); // 16 MHz ticks to ns
+            hal.stream.write(",");
+            hal.stream.write(uitoa(max * 125 / 2));
+            hal.stream.write(",");
+            hal.stream.write(uitoa((max - min) * 125 / 2));
+            hal.stream.write(",");
+#if STEP_ISR_MONITOR
+            hal.stream.write(uitoa((uint32_t)(total * 125 / 2 / samples)));
+            hal.stream.write(",");
+#endif
+        }
+        hal.stream.write(uitoa(samples));
+#if STEP_ISR_MONITOR
+        hal.stream.write(",");
+        hal.stream.write(uitoa(overruns));
+#endif
+        hal.stream.write("]" ASCII_EOL);
+    }
+
+    return Status_OK;
+}
+
+#endif
+
 // Configures perhipherals when settings are initialized or changed
 void settings_changed (settings_t *settings, settings_changed_flags_t changed)
 {
@@ -618,113 +1248,98 @@ void settings_changed (settings_t *settings, settings_changed_flags_t changed)
         }
 #endif
 
+        uint16_t length, delay = 0;
         int16_t t = (int16_t)(24.0f * (settings->steppers.pulse_microseconds - STEP_PULSE_LATENCY)) - 1;
-        pulse_length = t < 2 ? 2 : t;
+        length = t < 2 ? 2 : t;
 
         if(settings->steppers.pulse_delay_microseconds > 0.0f) {
             t = (int16_t)(24.0f * (settings->steppers.pulse_delay_microseconds - 1.7f)) - 1;
-            pulse_delay = t < 2 ? 2 : t;
-            hal.stepper.pulse_start = stepperPulseStartDelayed;
-        } else
-            hal.stepper.pulse_start = stepperPulseStart;
+            delay = t < 2 ? 2 : t;
+        }
 
-        next_step_outbits.value = 0;
-        IRQRegister(STEP_TIMER_IRQn, STEPPULSE_IRQHandler);
+        if(length != pulse_length || delay != pulse_delay) {
+
+            pulse_length = length;
+            pulse_delay = delay;
+            next_step_outbits.value = 0;
+
+#if STEP_DUAL_EDGE
+            hal.stepper.pulse_start = pulse_delay ? stepperPulseStartDualEdgeDelayed : stepperPulseStartDualEdge;
+
+            IRQRegister(STEP_TIMER_IRQn, STEPPULSE_DualEdge_IRQHandler);
+
+            STEP_TIMER->COUNT16.CC[0].reg = pulse_delay ? pulse_delay : pulse_length;
+#else
+            hal.stepper.pulse_start = pulse_delay ? stepperPulseStartDelayed : stepperPulseStart;
 
-        STEP_TIMER->COUNT16.CC[0].reg = pulse_length;
-        STEP_TIMER->COUNT16.INTENSET.bit.MC0 = 1; // Enable CC0 interrupt
+            IRQRegister(STEP_TIMER_IRQn, STEPPULSE_IRQHandler);
+
+            STEP_TIMER->COUNT16.CC[0].reg = pulse_length;
+#endif
+            STEP_TIMER->COUNT16.INTENSET.bit.MC0 = 1; // Enable CC0 interrupt
+        }
 
         /*************************
          *  Control pins config  *
          *************************/
 
-        NVIC_DisableIRQ(EIC_IRQn);
-        NVIC_SetPriority(EIC_IRQn, 3);
+        // Only inputs with changed pull or edge settings are touched. Interrupts from other inputs
+        // are held pending in the EIC while updating and serviced when done.
+
+        static bool inputs_init = false;
 
+        bool pull_changed = false;
+        uint32_t inputs_changed = 0;
         control_signals_t control_ies;
 
+        NVIC_DisableIRQ(EIC_IRQn);
+        NVIC_SetPriority(EIC_IRQn, 3);
+
         control_ies.mask = (settings->control_disable_pullup.mask ^ settings->control_invert.mask);
 
 #ifdef SAFETY_DOOR_PIN
-        detachInterrupt(SAFETY_DOOR_PIN);
-        pinMode(SAFETY_DOOR_PIN, settings->control_disable_pullup.safety_door_ajar ? INPUT_PULLDOWN : INPUT_PULLUP);
-        attachInterrupt(SAFETY_DOOR_PIN, CONTROL_IRQHandler, control_ies.safety_door_ajar ? FALLING : RISING);
+        inputs_changed |= pinInputUpdate(SAFETY_DOOR_PIN, !settings->control_disable_pullup.safety_door_ajar, control_ies.safety_door_ajar ? EIC_CONFIG_SENSE0_FALL_Val : EIC_CONFIG_SENSE0_RISE_Val, CONTROL_IRQHandler, &pull_changed);
 #endif
+        inputs_changed |= pinInputUpdate(CYCLE_START_PIN, !settings->control_disable_pullup.cycle_start, control_ies.cycle_start ? EIC_CONFIG_SENSE0_FALL_Val : EIC_CONFIG_SENSE0_RISE_Val, CONTROL_IRQHandler, &pull_changed);
+        inputs_changed |= pinInputUpdate(FEED_HOLD_PIN, !settings->control_disable_pullup.feed_hold, control_ies.feed_hold ? EIC_CONFIG_SENSE0_FALL_Val : EIC_CONFIG_SENSE0_RISE_Val, CONTROL_IRQHandler, &pull_changed);
+        inputs_changed |= pinInputUpdate(RESET_PIN, !settings->control_disable_pullup.reset, control_ies.reset ? EIC_CONFIG_SENSE0_FALL_Val : EIC_CONFIG_SENSE0_RISE_Val, CONTROL_IRQHandler, &pull_changed);
 
-        detachInterrupt(CYCLE_START_PIN);
-        detachInterrupt(FEED_HOLD_PIN);
-        detachInterrupt(RESET_PIN);
-        
-        pinMode(CYCLE_START_PIN, settings->control_disable_pullup.cycle_start ? INPUT_PULLDOWN : INPUT_PULLUP);
-        pinMode(FEED_HOLD_PIN, settings->control_disable_pullup.feed_hold ? INPUT_PULLDOWN : INPUT_PULLUP);
-        pinMode(RESET_PIN, settings->control_disable_pullup.reset ? INPUT_PULLDOWN : INPUT_PULLUP);
-
-        attachInterrupt(CYCLE_START_PIN, CONTROL_IRQHandler, control_ies.cycle_start ? FALLING : RISING);
-        attachInterrupt(FEED_HOLD_PIN, CONTROL_IRQHandler, control_ies.feed_hold ? FALLING : RISING);
-        attachInterrupt(RESET_PIN, CONTROL_IRQHandler, control_ies.reset ? FALLING : RISING);
-                
         /***********************
          *  Limit pins config  *
          ***********************/
 
-//        axes_signals_t limit_ies;
+        // NOTE: limit interrupts are enabled here on first call only, later enabled/disabled by limitsEnable()
 
         limit_ies.mask = settings->limits.disable_pullup.mask ^ settings->limits.invert.mask;
-        
-        detachInterrupt(X_LIMIT_PIN);
-        detachInterrupt(Y_LIMIT_PIN);
-        detachInterrupt(Z_LIMIT_PIN);
-        
-        pinMode(X_LIMIT_PIN, settings->limits.disable_pullup.x ? INPUT_PULLDOWN : INPUT_PULLUP);
-        pinMode(Y_LIMIT_PIN, settings->limits.disable_pullup.y ? INPUT_PULLDOWN : INPUT_PULLUP);
-        pinMode(Z_LIMIT_PIN, settings->limits.disable_pullup.z ? INPUT_PULLDOWN : INPUT_PULLUP);
 
-        attachInterrupt(X_LIMIT_PIN, LIMIT_IRQHandler, limit_ies.x ? FALLING : RISING);
-        attachInterrupt(Y_LIMIT_PIN, LIMIT_IRQHandler, limit_ies.y ? FALLING : RISING);
-        attachInterrupt(Z_LIMIT_PIN, LIMIT_IRQHandler, limit_ies.z ? FALLING : RISING);
+        inputs_changed |= pinInputUpdate(X_LIMIT_PIN, !settings->limits.disable_pullup.x, limit_ies.x ? EIC_CONFIG_SENSE0_FALL_Val : EIC_CONFIG_SENSE0_RISE_Val, LIMIT_IRQHandler, &pull_changed);
+        inputs_changed |= pinInputUpdate(Y_LIMIT_PIN, !settings->limits.disable_pullup.y, limit_ies.y ? EIC_CONFIG_SENSE0_FALL_Val : EIC_CONFIG_SENSE0_RISE_Val, LIMIT_IRQHandler, &pull_changed);
+        inputs_changed |= pinInputUpdate(Z_LIMIT_PIN, !settings->limits.disable_pullup.z, limit_ies.z ? EIC_CONFIG_SENSE0_FALL_Val : EIC_CONFIG_SENSE0_RISE_Val, LIMIT_IRQHandler, &pull_changed);
 
 #if I2C_STROBE_ENABLE
-        pinMode(I2C_STROBE_PIN, INPUT_PULLUP);
-        attachInterrupt(I2C_STROBE_PIN, I2C_Strobe_IRQHandler, CHANGE);
+        inputs_changed |= pinInputUpdate(I2C_STROBE_PIN, true, EIC_CONFIG_SENSE0_BOTH_Val, I2C_Strobe_IRQHandler, &pull_changed);
 #endif
 
-        // Bad code elsewhere requires this...
-        hal.delay_ms(2, NULL);
-        EIC->INTFLAG.reg = 0x0003FFFF;
-        NVIC_ClearPendingIRQ(EIC_IRQn);
+        if(inputs_changed) {
+            // A changed pull or edge may raise a spurious interrupt, wait for the input to settle
+            // if the pull was changed and clear the flags for the changed inputs only.
+            if(pull_changed)
+                hal.delay_ms(2, NULL);
+            EIC->INTFLAG.reg = inputs_changed;
+            if(!inputs_init)
+                EIC->INTENSET.reg = inputs_changed;
+        }
+
+        inputs_init = true;
+
         NVIC_EnableIRQ(EIC_IRQn);
-        // ...or we will enter ALARM!
-
-/*      
-        EExt_Interrupts irq;
-    #if ARDUINO_SAMD_VARIANT_COMPLIANCE >= 10606
-        irq = g_APinDescription[X_LIMIT_PIN].ulExtInt;
-    #else
-        irq = digitalPinToInterrupt(X_LIMIT_PIN);
-    #endif  
-        lim_IRQMask = EIC_INTENSET_EXTINT(1 << irq);
-        
-    #if ARDUINO_SAMD_VARIANT_COMPLIANCE >= 10606
-        irq = g_APinDescription[Y_LIMIT_PIN].ulExtInt;
-    #else
-        irq = digitalPinToInterrupt(Y_LIMIT_PIN);
-    #endif  
-        lim_IRQMask |= EIC_INTENSET_EXTINT(1 << irq);
-        
-    #if ARDUINO_SAMD_VARIANT_COMPLIANCE >= 10606
-        irq = g_APinDescription[Z_LIMIT_PIN].ulExtInt;
-    #else
-        irq = digitalPinToInterrupt(Z_LIMIT_PIN);
-    #endif  
-        lim_IRQMask |= EIC_INTENSET_EXTINT(1 << irq);
-
-        limitsEnable(settings->limits.flags.hard_enabled, false);
-*/
+
         /**********************
          *  Probe pin config  *
          **********************/
-#ifdef PROBE_PIN         
-        pinMode(PROBE_PIN, hal.driver_cap.probe_pull_up ? INPUT_PULLUP : INPUT_PULLDOWN);
+#ifdef PROBE_PIN
+        if(!pinPullMatch(PROBE_PIN, hal.driver_cap.probe_pull_up))
+            pinModeInput(PROBE_PIN, hal.driver_cap.probe_pull_up);
 #endif
     }
 }
@@ -794,9 +1409,43 @@ static bool driver_setup (settings_t *settings)
     pinModeOutput(&dirY, Y_DIRECTION_PIN);
     pinModeOutput(&dirZ, Z_DIRECTION_PIN);
 
-// Enable GPIO interrupt (done by Arduino library for now)
-//  IRQRegister(EIC_IRQn, LIMIT_IRQHandler);
-//  NVIC_EnableIRQ(EIC_IRQn);
+#if STEP_DUAL_EDGE
+    {
+        uint_fast8_t idx, axis;
+        gpio_t *step_pin[] = { &stepX, &stepY, &stepZ };
+
+        for(idx = 1; idx < 8; idx++) {
+            for(axis = 0; axis < 3; axis++) {
+                if(idx & (1 << axis)) {
+                    if(step_pin[axis]->port == &PORT->Group[0])
+                        step_toggle[idx].a |= step_pin[axis]->bit;
+                    else
+                        step_toggle[idx].b |= step_pin[axis]->bit;
+                }
+            }
+        }
+    }
+#endif
+
+#if BACKLASH_ENABLE
+    backlash_setup();
+#endif
+
+    // External interrupt controller, enabled by settings_changed()
+
+    PM->APBAMASK.reg |= PM_APBAMASK_EIC;
+
+    GCLK->CLKCTRL.reg = (uint16_t)(GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 | GCLK_CLKCTRL_ID_EIC);
+    while(GCLK->STATUS.bit.SYNCBUSY);
+
+    EIC->CTRL.bit.ENABLE = 1;
+    while(EIC->STATUS.bit.SYNCBUSY);
+
+#if SPINDLE_SYNC_ENABLE
+    spindle_sync_setup();
+#endif
+
+    IRQRegister(EIC_IRQn, EIC_IRQHandler);
 
     if(hal.driver_cap.software_debounce) {
 
@@ -838,13 +1487,12 @@ static bool driver_setup (settings_t *settings)
     pinModeOutput(&spindleDir, SPINDLE_DIRECTION_PIN);
   #endif
 #endif
-    pinMode(SPINDLE_PWM_PIN, OUTPUT);
+    PIN_GROUP(SPINDLE_PWM_PIN)->DIRSET.reg = PIN_BIT(SPINDLE_PWM_PIN);
 
     GCLK->CLKCTRL.reg = (uint16_t)(GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK7 | GCLK_CLKCTRL_ID_TCC0_TCC1); // 16 MHz
     while(GCLK->STATUS.bit.SYNCBUSY);
 
-    PORT->Group[g_APinDescription[SPINDLE_PWM_PIN].ulPort].PINCFG[g_APinDescription[SPINDLE_PWM_PIN].ulPin].bit.PMUXEN = 1;
-    PORT->Group[g_APinDescription[SPINDLE_PWM_PIN].ulPort].PMUX[g_APinDescription[SPINDLE_PWM_PIN].ulPin >> 1].reg = PORT_PMUX_PMUXE_F;
+    pinMux(SPINDLE_PWM_PIN, PORT_PMUX_PMUXE_F_Val);
 
     SPINDLE_PWM_TIMER->CTRLA.bit.ENABLE = 0;
     while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.ENABLE);
@@ -864,10 +1512,31 @@ static bool driver_setup (settings_t *settings)
     ioexpand_init();
 #endif
 
+#if AUX_OUTPUTS_ENABLE
+    uint_fast8_t idx;
+    for(idx = 0; idx < N_AUX_OUT; idx++)
+        pinModeOutput(&aux_out[idx], aux_out_pin[idx]);
+#endif
+
 #ifdef DEBUGOUT
     pinModeOutput(&Led, LED_BUILTIN);
 #endif
 
+#if ANALOG_ENABLE
+    if(analog_init()) {
+  #ifdef ANALOG_FEED_HOLD_CHANNEL
+    #ifndef ANALOG_FEED_HOLD_LOW
+    #define ANALOG_FEED_HOLD_LOW 0
+    #endif
+    #ifndef ANALOG_FEED_HOLD_HIGH
+    #define ANALOG_FEED_HOLD_HIGH ANALOG_MAX_VALUE
+    #endif
+        analog_set_window(ANALOG_FEED_HOLD_CHANNEL, ANALOG_FEED_HOLD_LOW, ANALOG_FEED_HOLD_HIGH, analogFeedHold);
+  #endif
+    } else
+        hal.port.num_analog_in = 0;
+#endif
+
  // Set defaults
 
     IOInitDone = settings->version.id == 23;
@@ -877,11 +1546,11 @@ static bool driver_setup (settings_t *settings)
     hal.stepper.go_idle(true);
 
 #if SDCARD_ENABLE
-    pinMode(SD_CD_PIN, INPUT_PULLUP);
+    pinModeInput(SD_CD_PIN, true);
 
 // This does not work, the card detect pin is not interrupt capable(!) and inserting a card causes a hard reset...
 // The bootloader needs modifying for it to work? Or perhaps the schematic is plain wrong?
-// attachInterrupt(SD_CD_PIN, SD_IRQHandler, CHANGE);
+// pinIRQEnable(SD_CD_PIN, EIC_CONFIG_SENSE0_BOTH_Val, SD_IRQHandler);
 
     if(pinIn(SD_CD_PIN) == 0)
         power_on();
@@ -889,6 +1558,11 @@ static bool driver_setup (settings_t *settings)
     sdcard_init();
 #endif
 
+#if POWERFAIL_ENABLE
+    if(IOInitDone)
+        powerfail_init((void *)(NVMCTRL->PARAM.bit.NVMP * (8 << NVMCTRL->PARAM.bit.PSZ) - GRBL_NVS_SIZE));
+#endif
+
     return IOInitDone;
 }
 
@@ -948,8 +1622,9 @@ bool nvsWrite (uint8_t *source)
         
         size -= grblNVS.page_size;
     }
-        
-    return true;
+
+    // Verify
+    return crc32_compute(grblNVS.addr, hal.nvs.size) == crc32_compute(source, hal.nvs.size);
 }
 
 bool nvsInit (void)
@@ -969,9 +1644,11 @@ bool driver_init (void) {
 
     // Enable EEPROM and serial port here for Grbl to be able to configure itself and report any errors
 
+#if !BARE_METAL
     init(); // system init (wiring.h)
+#endif
 
-    // Copy vector table to RAM so we can override the default Arduino IRQ assignments
+    // Copy vector table to RAM so we can override the default IRQ assignments
 
     __disable_irq();
 
@@ -983,13 +1660,19 @@ bool driver_init (void) {
 
     // End vector table copy
 
+#if DETERMINISTIC_TIMING
+    NVMCTRL->CTRLB.bit.READMODE = NVMCTRL_CTRLB_READMODE_DETERMINISTIC_Val;
+#endif
+
     SysTick->LOAD = (SystemCoreClock / 1000) - 1;
     SysTick->VAL = 0;
-    SysTick->CTRL |= SysTick_CTRL_CLKSOURCE_Msk|SysTick_CTRL_TICKINT_Msk;
+    SysTick->CTRL |= SysTick_CTRL_CLKSOURCE_Msk|SysTick_CTRL_TICKINT_Msk|SysTick_CTRL_ENABLE_Msk;
     NVIC_SetPriority(SysTick_IRQn, (1 << __NVIC_PRIO_BITS) - 1);
 
     IRQRegister(SysTick_IRQn, SysTick_IRQHandler);
 
+    crc_init();
+
     hal.info = "SAMD21";
     hal.driver_version = "241216";
     hal.driver_url = GRBL_URL "/SAMD21";
@@ -1009,7 +1692,11 @@ bool driver_init (void) {
     hal.stepper.go_idle = stepperGoIdle;
     hal.stepper.enable = stepperEnable;
     hal.stepper.cycles_per_tick = stepperCyclesPerTick;
+#if STEP_DUAL_EDGE
+    hal.stepper.pulse_start = stepperPulseStartDualEdge;
+#else
     hal.stepper.pulse_start = stepperPulseStart;
+#endif
 
     hal.limits.enable = limitsEnable;
     hal.limits.get_state = limitsGetState;
@@ -1024,6 +1711,16 @@ bool driver_init (void) {
 
     hal.control.get_state = systemGetState;
 
+#if AUX_OUTPUTS_ENABLE
+    hal.port.digital_out = digitalOut;
+    hal.port.num_digital_out = N_AUX_OUT;
+#endif
+
+#if ANALOG_ENABLE
+    hal.port.wait_on_input = waitOnInput;
+    hal.port.num_analog_in = ANALOG_AIN_COUNT;
+#endif
+
 #if DRIVER_SPINDLE_ENABLE
 
  #if DRIVER_SPINDLE_ENABLE & SPINDLE_PWM
@@ -1040,6 +1737,10 @@ bool driver_init (void) {
         .get_state = spindleGetState,
         .get_pwm = spindleGetPWM,
         .update_pwm = spindleSetSpeed,
+  #if SPINDLE_SYNC_ENABLE
+        .get_data = spindle_sync_get_data,
+        .reset_data = spindle_sync_reset_data,
+  #endif
         .cap = {
             .gpio_controlled = On,
             .variable = On,
@@ -1062,6 +1763,10 @@ bool driver_init (void) {
   #endif
         .set_state = spindleSetState,
         .get_state = spindleGetState,
+  #if SPINDLE_SYNC_ENABLE
+        .get_data = spindle_sync_get_data,
+        .reset_data = spindle_sync_reset_data,
+  #endif
         .cap = {
             .gpio_controlled = On,
   #if DRIVER_SPINDLE_ENABLE & SPINDLE_DIR
@@ -1074,8 +1779,16 @@ bool driver_init (void) {
 
     spindle_id = spindle_register(&spindle, DRIVER_SPINDLE_NAME);
 
+  #if SPINDLE_SYNC_ENABLE
+    hal.driver_cap.spindle_sync = On;
+  #endif
+
 #endif // DRIVER_SPINDLE_ENABLE
 
+#if VFD_ENABLE
+    vfd_init();
+#endif
+
 #if USB_SERIAL_CDC
     stream_connect(usbInit());
 #else
@@ -1105,8 +1818,8 @@ bool driver_init (void) {
     hal.set_bits_atomic = bitsSetAtomic;
     hal.clear_bits_atomic = bitsClearAtomic;
     hal.set_value_atomic = valueSetAtomic;
-    hal.get_micros = micros;
-    hal.get_elapsed_ticks = millis;
+    hal.get_micros = getMicros;
+    hal.get_elapsed_ticks = getElapsedTicks;
 
 #ifdef DEBUGOUT
     hal.debug_out = debug_out;
@@ -1138,6 +1851,83 @@ bool driver_init (void) {
     keypad_init();
 #endif
 
+#if ADAPTIVE_FEED_ENABLE
+    adaptive_feed_init();
+#endif
+
+#if THC_ENABLE
+    thc_init();
+#endif
+
+#if TELEMETRY_ENABLE
+    telemetry_init();
+#endif
+
+#if STEPTEST_ENABLE
+    steptest_init();
+#endif
+
+#if BACKLASH_ENABLE
+    backlash_init();
+#endif
+
+#if RASTER_ENABLE
+    raster_init(&spindle_pwm);
+#endif
+
+#if LASER_PPI_ENABLE
+    ppi_init();
+#endif
+
+#if SDJOB_ENABLE
+    sdjob_init();
+#endif
+
+#if USB_MSC_ENABLE
+    usb_msc_init();
+#endif
+
+    static const sys_command_t tx_command_list[] = {
+        {"TXQ", tx_stats_command, {0}, { .str = "report output queue statistics" } }
+    };
+
+    static sys_commands_t tx_commands = {
+        .n_commands = sizeof(tx_command_list) / sizeof(sys_command_t),
+        .commands = tx_command_list
+    };
+
+    system_register_commands(&tx_commands);
+
+#if AMASS_ADAPTIVE
+    static const sys_command_t amass_command_list[] = {
+        {"AMASS", amass_command, {0}, { .str = "report AMASS level, stepper interrupt cost in ns, max tick rate and capped segments" } }
+    };
+
+    static sys_commands_t amass_commands = {
+        .n_commands = sizeof(amass_command_list) / sizeof(sys_command_t),
+        .commands = amass_command_list
+    };
+
+    system_register_commands(&amass_commands);
+#endif
+
+#if DETERMINISTIC_TIMING || STEP_ISR_MONITOR
+    static const sys_command_t isr_command_list[] = {
+  #if STEP_ISR_MONITOR
+        {"ISR", isr_timing_command, {0}, { .str = "report stepper interrupt latency min, max, jitter and mean in ns and overrun count, $ISR=0 to reset" } }
+  #else
+        {"ISR", isr_timing_command, {0}, { .str = "report stepper interrupt latency min, max and jitter in ns, $ISR=0 to reset" } }
+  #endif
+    };
+
+    static sys_commands_t isr_commands = {
+        .n_commands = sizeof(isr_command_list) / sizeof(sys_command_t),
+        .commands = isr_command_list
+    };
+
+    system_register_commands(&isr_commands);
+#endif
+
     my_plugin_init();
 
     // No need to move version check before init.
@@ -1148,21 +1938,88 @@ bool driver_init (void) {
 /* interrupt handlers */
 
 // Main stepper driver
-static void STEPPER_IRQHandler (void)
+static void RAMFUNC STEPPER_IRQHandler (void)
 {
     STEPPER_TIMER->COUNT32.INTFLAG.bit.MC0 = 1;
+#if DETERMINISTIC_TIMING || STEP_ISR_MONITOR
+    // Timer restarts from 0 on compare match, count is interrupt entry latency + constant read sync delay
+    STEPPER_TIMER->COUNT32.READREQ.reg = TC_READREQ_RREQ|TC_READREQ_ADDR(TC_COUNT32_COUNT_OFFSET);
+    while(STEPPER_TIMER->COUNT32.STATUS.bit.SYNCBUSY);
+    uint32_t latency = STEPPER_TIMER->COUNT32.COUNT.reg;
+    if(latency < isr_timing.min)
+        isr_timing.min = latency;
+    if(latency > isr_timing.max)
+        isr_timing.max = latency;
+    isr_timing.samples++;
+  #if STEP_ISR_MONITOR
+    isr_timing.total += latency;
+  #endif
+#endif
+#if AUX_OUTPUTS_ENABLE
+    if(aux_latch.pending)
+        aux_out_latched();
+    in_stepper_isr = true;
     hal.stepper.interrupt_callback();
+    in_stepper_isr = false;
+#else
+    hal.stepper.interrupt_callback();
+#endif
+#if STEP_INTERPOLATION
+    if(interp.ticks) {
+        interp.current = --interp.ticks ? interp.current + interp.delta : interp.target;
+        STEPPER_TIMER->COUNT32.CC[0].reg = interp.current;
+    }
+#endif
+#if STEP_ISR_MONITOR
+    // The compare match flag was cleared on entry, if set again the step period has been stretched
+    if(STEPPER_TIMER->COUNT32.INTFLAG.bit.MC0) {
+        isr_timing.overruns++;
+        isr_timing.load += 16;
+  #if STEP_ISR_OVERRUN_ALARM
+        // More than one in 16 ticks overrun on average over the last STEP_ISR_OVERRUN_ALARM ticks
+        if(isr_timing.load > STEP_ISR_OVERRUN_ALARM) {
+            isr_timing.load = 0;
+            mc_reset();
+            system_set_exec_alarm(Alarm_MotorFault);
+        }
+  #endif
+    } else if(isr_timing.load)
+        isr_timing.load--;
+#endif
+#if AMASS_ADAPTIVE
+    if(!(++amass.sample & 0x0F)) {
+        STEPPER_TIMER->COUNT32.READREQ.reg = TC_READREQ_RREQ|TC_READREQ_ADDR(TC_COUNT32_COUNT_OFFSET);
+        while(STEPPER_TIMER->COUNT32.STATUS.bit.SYNCBUSY);
+        uint32_t cost = STEPPER_TIMER->COUNT32.COUNT.reg;
+        amass.cost = cost > amass.cost ? cost : amass.cost - (amass.cost >> 8);
+    }
+#endif
 }
 
 // Step pulse handler
-static void STEPPULSE_IRQHandler (void)
+static void RAMFUNC STEPPULSE_IRQHandler (void)
 {
     STEP_TIMER->COUNT16.INTFLAG.bit.MC0 = 1;
     set_step_outputs((axes_signals_t){0}); // End step pulse.
 }
 
+#if STEP_DUAL_EDGE
+
+// Direction setup delay completed, output the pending step
+static void RAMFUNC STEPPULSE_DualEdge_IRQHandler (void)
+{
+    STEP_TIMER->COUNT16.INTFLAG.bit.MC0 = 1;
+
+    if(next_step_outbits.value) {
+        toggle_step_outputs(next_step_outbits);
+        next_step_outbits.value = 0;
+    }
+}
+
+#endif
+
 // Will only be called if AMASS is not used
-static void STEPPULSE_Delayed_IRQHandler (void)
+static void RAMFUNC STEPPULSE_Delayed_IRQHandler (void)
 {
     STEP_TIMER->COUNT16.INTFLAG.bit.MC0 = 1;
     STEP_TIMER->COUNT16.CC[0].reg = pulse_length;
@@ -1216,6 +2073,20 @@ static void LIMIT_IRQHandler (void)
         hal.limits.interrupt_callback(limitsGetState());
 }
 
+static void EIC_IRQHandler (void)
+{
+    uint32_t extint = 0, flags = EIC->INTFLAG.reg & EIC->INTENSET.reg;
+
+    EIC->INTFLAG.reg = flags;
+
+    while(flags) {
+        if((flags & 0x01) && eic_handler[extint])
+            eic_handler[extint]();
+        extint++;
+        flags >>= 1;
+    }
+}
+
 static void SD_IRQHandler (void)
 {
     sd_detect = true;
@@ -1234,6 +2105,23 @@ void I2C_Strobe_IRQHandler (void)
 // Interrupt handler for 1 ms interval timer
 static void SysTick_IRQHandler (void)
 {
+    elapsed_ticks++;
+
+#if ADAPTIVE_FEED_ENABLE
+    if(IOInitDone)
+        adaptive_feed_poll();
+#endif
+
+#if THC_ENABLE
+    if(IOInitDone)
+        thc_poll();
+#endif
+
+#if TELEMETRY_ENABLE
+    if(IOInitDone)
+        telemetry_poll();
+#endif
+
 #if SDCARD_ENABLE
     static uint32_t fatfs_ticks = 10;
     if(!(--fatfs_ticks)) {
@@ -26,6 +26,8 @@
 #ifndef __DRIVER_H__
 #define __DRIVER_H__
 
+#include "sam.h"
+
 #include "grbl/hal.h"
 
 #ifndef OVERRIDE_MY_MACHINE
@@ -49,6 +51,12 @@
 #define DEBOUNCE_TIMER      TCC1
 #define DEBOUNCE_TIMER_IRQn TCC1_IRQn
 
+// event system channels
+
+#define EVSYS_CH_SPINDLE_INDEX  0
+#define EVSYS_CH_SPINDLE_PULSE  1
+#define EVSYS_CH_LASER_PPI      2
+
 #ifdef BOARD_CNC_BOOSTERPACK
   #include "cnc_boosterpack_map.h"
 #elif defined(BOARD_MY_MACHINE)
@@ -57,6 +65,96 @@
   #include "generic_map.h"
 #endif
 
+#if DETERMINISTIC_TIMING
+// The Arduino core linker script has no .ramfunc input section, code placed in a .data subsection is
+// copied to RAM at startup along with initialized data. Calls to flash are reached via linker veneers.
+#define RAMFUNC __attribute__((section(".data.ramfunc"), noinline))
+#else
+#define RAMFUNC
+#endif
+
+#if SPINDLE_SYNC_ENABLE && !(DRIVER_SPINDLE_ENABLE && defined(SPINDLE_INDEX_PIN))
+#error "Spindle sync requires the driver spindle and a SPINDLE_INDEX_PIN defined by the board map!"
+#endif
+
+#if SPINDLE_SYNC_ENABLE && BACKLASH_ENABLE
+#error "Spindle sync and backlash compensation cannot be enabled together, both use TCC2!"
+#endif
+
+#if AMASS_ADAPTIVE && !defined(ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING)
+#error "AMASS_ADAPTIVE requires ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING enabled in grbl/config.h!"
+#endif
+
+#if STEP_ISR_OVERRUN_ALARM && !STEP_ISR_MONITOR
+#error "STEP_ISR_OVERRUN_ALARM requires STEP_ISR_MONITOR!"
+#endif
+
+#if STEP_INTERPOLATION && (STEP_INTERPOLATION < 1 || STEP_INTERPOLATION > 5)
+#error "STEP_INTERPOLATION must be in the range 1 - 5!"
+#endif
+
+#if BARE_METAL && USB_SERIAL_CDC
+#error "USB serial is not available in bare metal builds, comment out USB_SERIAL_CDC!"
+#endif
+
+#if ADAPTIVE_FEED_ENABLE && !ANALOG_ENABLE
+#error "Adaptive feed override requires ANALOG_ENABLE!"
+#endif
+
+#if THC_ENABLE && !ANALOG_ENABLE
+#error "Torch height control requires ANALOG_ENABLE!"
+#endif
+
+#if ANALOG_ENABLE
+#if !defined(ANALOG_AIN_FIRST) || !defined(ANALOG_AIN_COUNT)
+#error "Analog inputs are not defined by the board map!"
+#endif
+#undef DMA_ENABLE
+#define DMA_ENABLE 1
+#endif
+
+#if VFD_ENABLE
+#undef MODBUS_ENABLE
+#define MODBUS_ENABLE 1
+#endif
+
+#if MODBUS_ENABLE
+#if !USB_SERIAL_CDC && !defined(MODBUS_SERCOM)
+#error "Modbus requires USB_SERIAL_CDC or a MODBUS_SERCOM defined by the board map!"
+#endif
+#undef DMA_ENABLE
+#define DMA_ENABLE 1
+#endif
+
+#if USB_MSC_ENABLE && !(SDCARD_ENABLE && USB_SERIAL_CDC)
+#error "USB mass storage requires SDCARD_ENABLE and USB_SERIAL_CDC!"
+#endif
+
+#if SDJOB_ENABLE && !SDCARD_ENABLE
+#error "SD card jobs require SDCARD_ENABLE!"
+#endif
+
+#if LASER_PPI_ENABLE && !(DRIVER_SPINDLE_ENABLE & SPINDLE_PWM)
+#error "Laser PPI requires the driver PWM spindle!"
+#endif
+
+#if LASER_PPI_ENABLE && RASTER_ENABLE
+#error "Laser PPI and raster cannot be enabled together, both use the spindle PWM timer!"
+#endif
+
+#if RASTER_ENABLE && !(DRIVER_SPINDLE_ENABLE & SPINDLE_PWM)
+#error "Laser raster requires the driver PWM spindle!"
+#endif
+
+#if SDCARD_ENABLE
+#undef DMA_ENABLE
+#define DMA_ENABLE 1
+#endif
+
+#if defined(AUXOUTPUT0_PIN) || defined(AUXOUTPUT1_PIN) || defined(AUXOUTPUT2_PIN) || defined(AUXOUTPUT3_PIN)
+#define AUX_OUTPUTS_ENABLE 1
+#endif
+
 // Adjust STEP_PULSE_LATENCY to get accurate step pulse length when required, e.g if using high step rates.
 // The default value is calibrated for 10 microseconds length.
 // NOTE: step output mode, number of axes and compiler optimization settings may all affect this value.
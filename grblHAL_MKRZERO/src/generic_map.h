@@ -66,7 +66,32 @@
 #endif
 
 // Define probe switch input pin.
+#if SPINDLE_SYNC_ENABLE
+#define SPINDLE_PULSE_PIN       (18u) // Spindle encoder pulse input, replaces the probe input
+#else
 #define PROBE_PIN               (18U)
+#endif
+
+// Define auxiliary output pins, used for M62-M65.
+#if !ANALOG_ENABLE
+#define AUXOUTPUT0_PIN          (25u) // ARef
+#endif
+#if !SAFETY_DOOR_ENABLE
+#if SPINDLE_SYNC_ENABLE
+#define SPINDLE_INDEX_PIN       (5u) // Spindle index input
+#elif MODBUS_ENABLE || VFD_ENABLE
+#define MODBUS_DIRECTION_PIN    (5u) // RS485 driver enable
+#else
+#define AUXOUTPUT1_PIN          (5u)
+#endif
+#endif
+
+// Define analog inputs, consecutive ADC inputs are scanned.
+// NOTE: All other ADC capable header pins are in use by this map.
+#if ANALOG_ENABLE
+#define ANALOG_AIN_FIRST        1 // AIN1, ARef (PA03)
+#define ANALOG_AIN_COUNT        1
+#endif
 
 /**/
 
@@ -25,14 +25,11 @@
 
 #ifdef I2C_PORT
 
-#include <Arduino.h>
-
 #include "sam.h"
-#include "variant.h"
-#include "wiring_private.h"
 
 #include "i2c.h"
 #include "serial.h"
+#include "mcu_pins.h"
 
 #if TRINAMIC_ENABLE && TRINAMIC_I2C
 #define I2C_ADR_I2CBRIDGE 0x47
@@ -233,8 +230,8 @@ void i2c_init (void)
 
         init_ok = true;
 
-        pinPeripheral(I2C_SDA_PIN, g_APinDescription[I2C_SDA_PIN].ulPinType); // PIO_SERCOM
-        pinPeripheral(I2C_SCL_PIN, g_APinDescription[I2C_SCL_PIN].ulPinType);
+        pinMux(I2C_SDA_PIN, PORT_PMUX_PMUXE_D_Val); // SERCOM2 PAD0
+        pinMux(I2C_SCL_PIN, PORT_PMUX_PMUXE_D_Val); // SERCOM2 PAD1
 
         initSerClockNVIC(i2c_port);
 
@@ -23,8 +23,20 @@
 
 // Double tap reset to enter bootloader mode - select bootloader port for programming
 
+#include "driver.h"
 #include "grbl/grbllib.h"
 
+#if BARE_METAL
+
+int main (void)
+{
+    grbl_enter();
+
+    return 0;
+}
+
+#else
+
 void setup ()
 {
     grbl_enter();
@@ -33,3 +45,5 @@ void setup ()
 void loop ()
 {
 }
+
+#endif
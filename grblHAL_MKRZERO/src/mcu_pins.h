@@ -0,0 +1,103 @@
+/*
+
+  mcu_pins.h - Arduino MKRZERO pin number to SAMD21 port pin mapping, resolved at compile time
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _MCU_PINS_H_
+#define _MCU_PINS_H_
+
+#include <stdint.h>
+
+#include "sam.h"
+
+#define PORTA 0
+#define PORTB 1
+#define NO_EXTINT 0xFF
+
+typedef struct {
+    uint8_t port;
+    uint8_t pin;
+    uint8_t extint;
+} mcu_pin_t;
+
+// Pins are referenced by the Arduino pin number used in the board maps.
+// Lookups are done with constant indices and folded by the compiler.
+static const mcu_pin_t mcu_pin[] = {
+    { PORTA, 22, 6 },           //  0
+    { PORTA, 23, 7 },           //  1
+    { PORTA, 10, 10 },          //  2
+    { PORTA, 11, 11 },          //  3
+    { PORTB, 10, 10 },          //  4
+    { PORTB, 11, 11 },          //  5
+    { PORTA, 20, 4 },           //  6
+    { PORTA, 21, 5 },           //  7
+    { PORTA, 16, 0 },           //  8
+    { PORTA, 17, 1 },           //  9
+    { PORTA, 19, 3 },           // 10
+    { PORTA,  8, NO_EXTINT },   // 11 - SDA, EXTINT is NMI
+    { PORTA,  9, 9 },           // 12 - SCL
+    { PORTB, 23, 7 },           // 13 - UART RX
+    { PORTB, 22, 6 },           // 14 - UART TX
+    { PORTA,  2, 2 },           // 15 - A0
+    { PORTB,  2, 2 },           // 16 - A1
+    { PORTB,  3, 3 },           // 17 - A2
+    { PORTA,  4, 4 },           // 18 - A3
+    { PORTA,  5, 5 },           // 19 - A4
+    { PORTA,  6, 6 },           // 20 - A5
+    { PORTA,  7, 7 },           // 21 - A6
+    { PORTA, 24, NO_EXTINT },   // 22 - USB D-, not available
+    { PORTA, 25, NO_EXTINT },   // 23 - USB D+, not available
+    { PORTA, 18, NO_EXTINT },   // 24 - not available
+    { PORTA,  3, 3 },           // 25 - ARef
+    { PORTA, 12, 12 },          // 26 - SD MOSI
+    { PORTA, 13, 13 },          // 27 - SD SCK
+    { PORTA, 14, 14 },          // 28 - SD CS
+    { PORTA, 15, 15 },          // 29 - SD MISO
+    { PORTA, 27, 15 },          // 30 - SD card detect
+    { PORTA, 28, 8 },           // 31 - not available
+    { PORTB,  8, 8 }            // 32 - LED
+};
+
+#ifndef LED_BUILTIN
+#define LED_BUILTIN (32u)
+#endif
+
+#define PIN_GROUP(p) (&PORT->Group[mcu_pin[p].port])
+#define PIN_BIT(p) (1UL << mcu_pin[p].pin)
+
+#define pinIn(p) ((PIN_GROUP(p)->IN.reg & PIN_BIT(p)) != 0)
+#define pinOut(p, e) { if(e) PIN_GROUP(p)->OUTSET.reg = PIN_BIT(p); else PIN_GROUP(p)->OUTCLR.reg = PIN_BIT(p); }
+
+// Routes a pin to a peripheral function, function is one of PORT_PMUX_PMUXE_x_Val (A - H)
+static inline void pinMux (uint8_t p, uint8_t function)
+{
+    PortGroup *group = PIN_GROUP(p);
+    uint8_t pin = mcu_pin[p].pin;
+
+    if(pin & 0x01)
+        group->PMUX[pin >> 1].bit.PMUXO = function;
+    else
+        group->PMUX[pin >> 1].bit.PMUXE = function;
+
+    group->PINCFG[pin].bit.PMUXEN = 1;
+}
+
+#endif // _MCU_PINS_H_
@@ -0,0 +1,380 @@
+/*
+
+  modbus_rtu.c - Modbus RTU master over RS485
+
+  Frames are sent and received by DMA. The RS485 driver enable (DE) output is set before
+  transmission starts and cleared from the USART transmit complete interrupt.
+  The RTC, clocked at 1 MHz from OSC8M, times the response timeout and the 3.5 character
+  inter-frame silence that ends a response, it is restarted on each received start bit.
+  Requests are queued, callbacks are run in the foreground. The RTC is used as TCC2 is claimed
+  when backlash compensation or spindle synchronization is enabled, this keeps the Modbus timing
+  independent of the configuration. The RTC is otherwise unused.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if MODBUS_ENABLE
+
+#include <string.h>
+
+#include "modbus_rtu.h"
+#include "serial.h"
+#include "dma.h"
+#include "mcu_pins.h"
+
+#include "grbl/protocol.h"
+
+#ifndef MODBUS_BAUDRATE
+#define MODBUS_BAUDRATE     19200
+#endif
+#ifndef MODBUS_RX_TIMEOUT
+#define MODBUS_RX_TIMEOUT   50 // ms
+#endif
+
+// Default port is the UART header (SERCOM5, pins 13 & 14), available when USB is used for communication.
+#ifndef MODBUS_SERCOM
+#define MODBUS_SERCOM       SERCOM5
+#define MODBUS_IRQn         SERCOM5_IRQn
+#define MODBUS_DMAC_ID_TX   SERCOM5_DMAC_ID_TX
+#define MODBUS_DMAC_ID_RX   SERCOM5_DMAC_ID_RX
+#define MODBUS_TX_PIN       (14u)
+#define MODBUS_RX_PIN       (13u)
+#define MODBUS_PMUX         PORT_PMUX_PMUXE_D_Val
+#define MODBUS_TXPO         1 // TX on PAD2
+#define MODBUS_RXPO         3 // RX on PAD3
+#endif
+
+// T3.5 in us, fixed at 1750 us for baud rates above 19200
+#if MODBUS_BAUDRATE > 19200
+#define MODBUS_T35          1750
+#else
+#define MODBUS_T35          ((35 * 11 * 100000UL) / MODBUS_BAUDRATE + 1)
+#endif
+
+typedef enum {
+    Slot_Free = 0,
+    Slot_Queued,
+    Slot_Active,
+    Slot_Done
+} slot_state_t;
+
+typedef struct {
+    volatile slot_state_t state;
+    uint8_t exception;
+    modbus_rtu_message_t msg;
+    const modbus_rtu_callbacks_t *callbacks;
+} modbus_slot_t;
+
+typedef enum {
+    Modbus_Idle = 0,
+    Modbus_Transmit,
+    Modbus_AwaitResponse,
+    Modbus_Receive
+} modbus_state_t;
+
+static Sercom *port = MODBUS_SERCOM;
+static volatile modbus_state_t state = Modbus_Idle;
+static modbus_slot_t queue[MODBUS_QUEUE_SIZE];
+static uint_fast8_t head = 0, tail = 0;
+static uint8_t rx_buf[MODBUS_MAX_ADU_SIZE];
+
+static void MODBUS_IRQHandler (void);
+static void RTC_IRQHandler (void);
+
+static uint16_t modbus_crc16 (const uint8_t *data, uint_fast8_t length)
+{
+    uint_fast8_t bit;
+    uint16_t crc = 0xFFFF;
+
+    while(length--) {
+        crc ^= *data++;
+        for(bit = 0; bit < 8; bit++)
+            crc = crc & 0x0001 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+
+    return crc;
+}
+
+static inline void set_direction (bool tx)
+{
+#ifdef MODBUS_DIRECTION_PIN
+    pinOut(MODBUS_DIRECTION_PIN, tx);
+#endif
+}
+
+static void timer_start (uint32_t us)
+{
+    RTC->MODE0.INTENCLR.reg = RTC_MODE0_INTENCLR_CMP0;
+    RTC->MODE0.COUNT.reg = 0;
+    while(RTC->MODE0.STATUS.bit.SYNCBUSY);
+    RTC->MODE0.COMP[0].reg = us;
+    while(RTC->MODE0.STATUS.bit.SYNCBUSY);
+    RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+    RTC->MODE0.INTENSET.reg = RTC_MODE0_INTENSET_CMP0;
+}
+
+static inline void timer_stop (void)
+{
+    RTC->MODE0.INTENCLR.reg = RTC_MODE0_INTENCLR_CMP0;
+}
+
+// Runs in the foreground
+static void modbus_callback (void *data)
+{
+    modbus_slot_t *slot = (modbus_slot_t *)data;
+
+    if(slot->callbacks) {
+        if(slot->exception) {
+            if(slot->callbacks->on_rx_exception)
+                slot->callbacks->on_rx_exception(slot->exception, slot->msg.context);
+        } else if(slot->callbacks->on_rx_packet)
+            slot->callbacks->on_rx_packet(&slot->msg);
+    }
+
+    slot->state = Slot_Free;
+}
+
+static void transmit_next (void)
+{
+    modbus_slot_t *slot = &queue[tail];
+
+    if(slot->state != Slot_Queued) {
+        state = Modbus_Idle;
+        return;
+    }
+
+    slot->state = Slot_Active;
+    state = Modbus_Transmit;
+
+    DmacDescriptor *desc = dma_descriptor(DMA_CHANNEL_MODBUS_TX);
+
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID|DMAC_BTCTRL_BEATSIZE_BYTE|DMAC_BTCTRL_SRCINC|DMAC_BTCTRL_BLOCKACT_NOACT;
+    desc->BTCNT.reg = slot->msg.tx_length + 2;
+    desc->SRCADDR.reg = (uint32_t)&slot->msg.adu[slot->msg.tx_length + 2]; // End address when incrementing
+    desc->DSTADDR.reg = (uint32_t)&port->USART.DATA.reg;
+    desc->DESCADDR.reg = 0;
+
+    set_direction(true);
+    dma_channel_enable(DMA_CHANNEL_MODBUS_TX);
+}
+
+static void complete (uint8_t exception)
+{
+    modbus_slot_t *slot = &queue[tail];
+
+    timer_stop();
+    port->USART.INTENCLR.reg = SERCOM_USART_INTENCLR_RXS;
+    dma_channel_disable(DMA_CHANNEL_MODBUS_RX);
+
+    slot->exception = exception;
+    slot->state = Slot_Done;
+    tail = (tail + 1) % MODBUS_QUEUE_SIZE;
+
+    // The response is dropped if the foreground task queue is full
+    if(!(slot->callbacks && protocol_enqueue_foreground_task(modbus_callback, slot)))
+        slot->state = Slot_Free;
+
+    transmit_next();
+}
+
+// Queues a request, returns false if the queue is full or the message is too long
+bool modbus_rtu_send (modbus_rtu_message_t *msg, const modbus_rtu_callbacks_t *callbacks)
+{
+    modbus_slot_t *slot = &queue[head];
+
+    if(slot->state != Slot_Free || msg->tx_length + 2 > MODBUS_MAX_ADU_SIZE || msg->rx_length > MODBUS_MAX_ADU_SIZE)
+        return false;
+
+    uint16_t crc = modbus_crc16(msg->adu, msg->tx_length);
+
+    memcpy(&slot->msg, msg, sizeof(modbus_rtu_message_t));
+    slot->msg.adu[msg->tx_length] = crc & 0xFF;
+    slot->msg.adu[msg->tx_length + 1] = crc >> 8;
+    slot->callbacks = callbacks;
+    slot->exception = 0;
+    slot->state = Slot_Queued;
+
+    head = (head + 1) % MODBUS_QUEUE_SIZE;
+
+    // Block the interrupts that may start the next transmission while checking for idle
+    NVIC_DisableIRQ(RTC_IRQn);
+    NVIC_DisableIRQ(MODBUS_IRQn);
+    NVIC_DisableIRQ(DMAC_IRQn);
+
+    if(state == Modbus_Idle)
+        transmit_next();
+
+    NVIC_EnableIRQ(DMAC_IRQn);
+    NVIC_EnableIRQ(MODBUS_IRQn);
+    NVIC_EnableIRQ(RTC_IRQn);
+
+    return true;
+}
+
+// DMA transmit complete, wait for the last character to be shifted out
+static void modbus_tx_dma_complete (uint8_t channel, uint8_t flags)
+{
+    port->USART.INTFLAG.reg = SERCOM_USART_INTFLAG_TXC;
+    port->USART.INTENSET.reg = SERCOM_USART_INTENSET_TXC;
+}
+
+bool modbus_rtu_init (void)
+{
+#ifdef MODBUS_DIRECTION_PIN
+    PIN_GROUP(MODBUS_DIRECTION_PIN)->PINCFG[mcu_pin[MODBUS_DIRECTION_PIN].pin].reg = (uint8_t)PORT_PINCFG_INEN;
+    PIN_GROUP(MODBUS_DIRECTION_PIN)->DIRSET.reg = PIN_BIT(MODBUS_DIRECTION_PIN);
+#endif
+    set_direction(false);
+
+    pinMux(MODBUS_TX_PIN, MODBUS_PMUX);
+    pinMux(MODBUS_RX_PIN, MODBUS_PMUX);
+
+    // RTC: 1 MHz count from OSC8M (GCLK3)
+
+    PM->APBAMASK.reg |= PM_APBAMASK_RTC;
+
+    GCLK->CLKCTRL.reg = (uint16_t)(GCLK_CLKCTRL_CLKEN|GCLK_CLKCTRL_GEN_GCLK3|GCLK_CLKCTRL_ID_RTC);
+    while(GCLK->STATUS.bit.SYNCBUSY);
+
+    RTC->MODE0.CTRL.bit.ENABLE = 0;
+    while(RTC->MODE0.STATUS.bit.SYNCBUSY);
+    RTC->MODE0.CTRL.bit.SWRST = 1;
+    while(RTC->MODE0.CTRL.bit.SWRST);
+    RTC->MODE0.CTRL.reg = RTC_MODE0_CTRL_MODE_COUNT32|RTC_MODE0_CTRL_PRESCALER_DIV8;
+    RTC->MODE0.CTRL.bit.ENABLE = 1;
+    while(RTC->MODE0.STATUS.bit.SYNCBUSY);
+
+    IRQRegister(RTC_IRQn, RTC_IRQHandler);
+    NVIC_SetPriority(RTC_IRQn, 2);
+    NVIC_EnableIRQ(RTC_IRQn);
+
+    // USART: 8N1, start of frame detection for RXS interrupt
+
+    IRQRegister(MODBUS_IRQn, MODBUS_IRQHandler);
+
+    initSerClockNVIC(port);
+    NVIC_SetPriority(MODBUS_IRQn, 2);
+
+    port->USART.CTRLA.bit.SWRST = 1;
+    while(port->USART.CTRLA.bit.SWRST || port->USART.SYNCBUSY.bit.SWRST);
+
+    port->USART.CTRLA.reg = SERCOM_USART_CTRLA_MODE_USART_INT_CLK|SERCOM_USART_CTRLA_SAMPR(1)|SERCOM_USART_CTRLA_DORD|
+                             SERCOM_USART_CTRLA_TXPO(MODBUS_TXPO)|SERCOM_USART_CTRLA_RXPO(MODBUS_RXPO);
+
+    uint32_t baudTimes8 = (SystemCoreClock * 8) / (16 * MODBUS_BAUDRATE);
+
+    port->USART.BAUD.FRAC.FP   = (baudTimes8 % 8);
+    port->USART.BAUD.FRAC.BAUD = (baudTimes8 / 8);
+
+    port->USART.CTRLB.reg = SERCOM_USART_CTRLB_CHSIZE(0)|SERCOM_USART_CTRLB_SFDE|SERCOM_USART_CTRLB_TXEN|SERCOM_USART_CTRLB_RXEN;
+    while(port->USART.SYNCBUSY.bit.CTRLB);
+
+    port->USART.CTRLA.bit.ENABLE = 1;
+    while(port->USART.SYNCBUSY.bit.ENABLE);
+
+    // DMA
+
+    dma_init();
+
+    dma_channel_config(DMA_CHANNEL_MODBUS_TX, MODBUS_DMAC_ID_TX, 1, modbus_tx_dma_complete);
+    dma_channel_config(DMA_CHANNEL_MODBUS_RX, MODBUS_DMAC_ID_RX, 1, NULL);
+
+    DmacDescriptor *desc = dma_descriptor(DMA_CHANNEL_MODBUS_RX);
+
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID|DMAC_BTCTRL_BEATSIZE_BYTE|DMAC_BTCTRL_DSTINC|DMAC_BTCTRL_BLOCKACT_NOACT;
+    desc->BTCNT.reg = sizeof(rx_buf);
+    desc->SRCADDR.reg = (uint32_t)&port->USART.DATA.reg;
+    desc->DSTADDR.reg = (uint32_t)&rx_buf[sizeof(rx_buf)]; // End address when incrementing
+    desc->DESCADDR.reg = 0;
+
+    return true;
+}
+
+static void MODBUS_IRQHandler (void)
+{
+    uint8_t ifg = port->USART.INTFLAG.reg & port->USART.INTENSET.reg;
+
+    if(ifg & SERCOM_USART_INTFLAG_TXC) {
+
+        // Last character sent, release the bus and start receiving
+        port->USART.INTENCLR.reg = SERCOM_USART_INTENCLR_TXC;
+        set_direction(false);
+
+        if(queue[tail].msg.rx_length == 0) {
+            // Broadcast, keep the bus idle for T3.5 before next request
+            state = Modbus_Receive;
+            timer_start(MODBUS_T35);
+        } else {
+            while(port->USART.INTFLAG.bit.RXC)
+                (void)port->USART.DATA.reg;
+            port->USART.INTFLAG.reg = SERCOM_USART_INTFLAG_RXS;
+            port->USART.INTENSET.reg = SERCOM_USART_INTENSET_RXS;
+            dma_channel_enable(DMA_CHANNEL_MODBUS_RX);
+            state = Modbus_AwaitResponse;
+            timer_start(MODBUS_RX_TIMEOUT * 1000);
+        }
+    }
+
+    if(ifg & SERCOM_USART_INTFLAG_RXS) {
+        // Character started, restart inter-frame silence timer
+        port->USART.INTFLAG.reg = SERCOM_USART_INTFLAG_RXS;
+        state = Modbus_Receive;
+        timer_start(MODBUS_T35);
+    }
+
+    if(ifg & SERCOM_USART_INTFLAG_ERROR)
+        port->USART.INTFLAG.reg = SERCOM_USART_INTFLAG_ERROR;
+}
+
+static void RTC_IRQHandler (void)
+{
+    RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+
+    if(state == Modbus_AwaitResponse)
+        complete(MODBUS_EXCEPTION_TIMEOUT);
+
+    else if(state == Modbus_Receive) {
+
+        modbus_slot_t *slot = &queue[tail];
+        uint_fast8_t length;
+
+        if(slot->msg.rx_length == 0) {
+            complete(0);
+            return;
+        }
+
+        dma_channel_disable(DMA_CHANNEL_MODBUS_RX);
+        length = sizeof(rx_buf) - dma_remaining(DMA_CHANNEL_MODBUS_RX);
+
+        if(length < 5 || modbus_crc16(rx_buf, length) != 0 || rx_buf[0] != slot->msg.adu[0])
+            complete(MODBUS_EXCEPTION_CRC);
+        else if(rx_buf[1] & 0x80)
+            complete(rx_buf[2]);
+        else if(length != slot->msg.rx_length)
+            complete(MODBUS_EXCEPTION_CRC);
+        else {
+            memcpy(slot->msg.adu, rx_buf, length);
+            complete(0);
+        }
+    }
+}
+
+#endif // MODBUS_ENABLE
@@ -0,0 +1,51 @@
+/*
+
+  modbus_rtu.h - Modbus RTU master over RS485
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _MODBUS_RTU_H_
+#define _MODBUS_RTU_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MODBUS_MAX_ADU_SIZE 16
+#define MODBUS_QUEUE_SIZE   4
+
+#define MODBUS_EXCEPTION_TIMEOUT 0xFF // Passed to on_rx_exception on response timeout
+#define MODBUS_EXCEPTION_CRC     0xFE // Passed to on_rx_exception on invalid response
+
+typedef struct {
+    void *context;
+    uint8_t tx_length;      // excluding CRC, CRC is appended by modbus_rtu_send()
+    uint8_t rx_length;      // expected response length including CRC, 0 for broadcast (no response)
+    uint8_t adu[MODBUS_MAX_ADU_SIZE];
+} modbus_rtu_message_t;
+
+typedef struct {
+    void (*on_rx_packet)(modbus_rtu_message_t *msg);
+    void (*on_rx_exception)(uint8_t code, void *context);
+} modbus_rtu_callbacks_t;
+
+bool modbus_rtu_init (void);
+bool modbus_rtu_send (modbus_rtu_message_t *msg, const modbus_rtu_callbacks_t *callbacks);
+
+#endif
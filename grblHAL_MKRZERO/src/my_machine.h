@@ -28,9 +28,38 @@
 // Uncomment to enable.
 
 #define USB_SERIAL_CDC       1 // Comment out to use UART communication.
+//#define BARE_METAL         1 // Build without the Arduino core, see startup_samd21.c. Requires UART communication.
+//#define DETERMINISTIC_TIMING 1 // Run step and serial interrupt handlers from RAM with deterministic flash timing, adds $ISR command for
+                                 // reporting stepper interrupt jitter. Add -DISR_CODE="__attribute__((section(\".data.ramfunc\")))" to the
+                                 // compiler flags to move the core stepper interrupt handler to RAM as well.
+//#define STEP_ISR_MONITOR   1 // Keep stepper interrupt lateness statistics and count overruns (step periods stretched by a late or
+                               // too long running interrupt), reported by the $ISR command.
+//#define STEP_ISR_OVERRUN_ALARM 256 // Raise a motor fault alarm when more than one in 16 stepper interrupts overruns on average over
+                                     // about this number of interrupts. Requires STEP_ISR_MONITOR.
+//#define AMASS_ADAPTIVE     1 // Measure stepper interrupt cost and adapt the AMASS level and tick rate limits to it when motion stops,
+                               // reported by the $AMASS command.
+//#define BACKLASH_ENABLE    1 // Backlash compensation by extra steps output by TCC2 on direction reversal, see backlash.c for settings.
+//#define SPINDLE_SYNC_ENABLE 1 // Spindle index and encoder pulse inputs for G33 spindle synchronized motion, uses the safety door and
+                                // probe inputs. Cannot be used with BACKLASH_ENABLE. See spindle_sync.c.
+//#define RASTER_ENABLE      1 // Laser raster scanlines, per pixel power output to the spindle PWM triggered by X steps. See raster.c.
+//#define LASER_PPI_ENABLE   1 // Laser pulses per inch mode, fixed length pulses triggered by software counted X/Y step events. See ppi.c for settings.
+//#define STEPTEST_ENABLE    1 // Add $STEPTEST command, reports the max sustainable step rate per AMASS level. See steptest.c.
+//#define STEP_DUAL_EDGE     1 // Toggle the step outputs instead of pulsing them, for drivers stepping on both edges (e.g. Trinamic DEDGE).
+                               // Doubles the max step rate as no pulse end interrupt is needed, the step pulse length setting is ignored.
+//#define STEP_INTERPOLATION 3 // Ramp the stepper timer reload linearly to a new segment rate over 2^n ticks, 1 - 5.
 //#define SAFETY_DOOR_ENABLE 1 // Enable safety door input.
 //#define IOEXPAND_ENABLE    1 // Use I2C IO expander for some output signals.
+//#define ANALOG_ENABLE      1 // ADC analog inputs sampled by DMA, available for M66.
+//#define ANALOG_FEED_HOLD_CHANNEL 0 // Analog input that raises a feed hold when outside ANALOG_FEED_HOLD_LOW - ANALOG_FEED_HOLD_HIGH (0 - 4095), checked once per ADC scan.
+//#define ADAPTIVE_FEED_ENABLE 1 // Adaptive feed override from spindle load, requires ANALOG_ENABLE. See adaptive_feed.c for settings.
+//#define THC_ENABLE         1 // Plasma torch height control from arc voltage, requires ANALOG_ENABLE. See thc.c for settings.
+//#define POWERFAIL_ENABLE   1 // Brown-out detection, saves machine state to flash on power fail.
+//#define TELEMETRY_ENABLE   1 // Binary telemetry frames in the output stream, enable with $TLM=<rate in Hz>. See telemetry.h for the record layout.
+//#define VFD_ENABLE         1 // Modbus RTU VFD spindle on the UART header pins, requires USB_SERIAL_CDC. See vfd_spindle.c for register settings.
 //#define SDCARD_ENABLE      1 // Run gcode programs from SD card. Set to 2 to enable YModem upload.
+//#define SDJOB_ENABLE       1 // Run G-code or pre-tokenised jobs from SD card with read-ahead buffering, $JOB=<file>. Requires SDCARD_ENABLE.
+                                 // Convert jobs with tools/gcode2tok.c, set SDJOB_BUFFER_SIZE to change the read-ahead buffer size (default 2048).
+//#define USB_MSC_ENABLE     1 // Expose the SD card as a USB drive with $MSC=1 when idle, requires SDCARD_ENABLE and USB_SERIAL_CDC.
 //#define TRINAMIC_ENABLE 2130 // Trinamic TMC2130 stepper driver support. NOTE: work in progress.
 //#define TRINAMIC_ENABLE 5160 // Trinamic TMC5160 stepper driver support. NOTE: work in progress.
 //#define TRINAMIC_I2C       0 // Trinamic I2C - SPI bridge interface.
@@ -0,0 +1,285 @@
+/*
+
+  powerfail.c - brown-out detection with machine state snapshot to flash
+
+  BOD33 is configured to raise an interrupt when the supply drops below POWERFAIL_BOD_LEVEL.
+  On a power fail the steppers are stopped and a snapshot of machine position, modal state
+  and program position is written to a flash row that is kept erased, this requires a single page write only.
+  After the snapshot is written BOD33 is switched to hold the processor in reset until power returns.
+
+  On startup a valid snapshot is reported, use:
+    $PF - to show the snapshot.
+    $PF=RESUME - to restore machine position and modal state from the snapshot.
+    $PF=CLEAR - to discard the snapshot, home the machine before continuing.
+
+  RESUME restores motion mode, coordinate system, plane, units, distance mode, feed mode and feed rate.
+  The spindle and coolant are left off, a warning is issued if they were on, restart them before
+  resuming the job with $JOB=<file>,<offset> using the offset reported by $PF. The job may repeat
+  the last block that was executing, take care with incremental distance mode.
+  The steppers are stopped without deceleration on a power fail so the restored position may be off
+  by lost steps: axes are not marked as homed and an alarm state is kept until unlocked with $X.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if POWERFAIL_ENABLE
+
+#include <string.h>
+
+#include "powerfail.h"
+#include "crc.h"
+
+#include "grbl/gcode.h"
+#include "grbl/settings.h"
+#include "grbl/system.h"
+#include "grbl/planner.h"
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+#include "grbl/nuts_bolts.h"
+#include "grbl/report.h"
+#include "grbl/motion_control.h"
+
+#ifndef POWERFAIL_BOD_LEVEL
+#define POWERFAIL_BOD_LEVEL 48 // approx. 3.0 V, see the datasheet electrical characteristics for BOD33 levels
+#endif
+
+#define SNAPSHOT_MAGIC 0x50464C32 // "PFL2"
+
+typedef struct {
+    uint32_t magic;
+    int32_t position[N_AXIS];
+    int32_t line_number;
+    uint32_t file_offset;
+    float feed_rate;
+    uint8_t motion;
+    uint8_t coord_system;
+    uint8_t plane;
+    uint8_t units_imperial;
+    uint8_t distance_incremental;
+    uint8_t feed_mode;
+    uint8_t spindle;
+    uint8_t coolant;
+    uint32_t checksum;
+} powerfail_snapshot_t;
+
+static struct {
+    uint32_t *row;
+    uint16_t row_size;
+    uint16_t page_size;
+    powerfail_snapshot_t snapshot;
+    powerfail_get_offset_ptr get_offset;
+} pf = {0};
+
+static void BOD_IRQHandler (void);
+
+static inline uint32_t snapshot_checksum (const powerfail_snapshot_t *snapshot)
+{
+    return crc32_compute(snapshot, offsetof(powerfail_snapshot_t, checksum));
+}
+
+static inline powerfail_snapshot_t *stored_snapshot (void)
+{
+    return (powerfail_snapshot_t *)pf.row;
+}
+
+static bool snapshot_valid (void)
+{
+    powerfail_snapshot_t *snapshot = stored_snapshot();
+
+    return snapshot->magic == SNAPSHOT_MAGIC && snapshot->checksum == snapshot_checksum(snapshot);
+}
+
+static bool row_erased (void)
+{
+    uint32_t words = pf.row_size / sizeof(uint32_t), *data = pf.row;
+
+    do {
+        if(*data++ != 0xFFFFFFFF)
+            return false;
+    } while(--words);
+
+    return true;
+}
+
+static void erase_row (void)
+{
+    while(!NVMCTRL->INTFLAG.bit.READY);
+    NVMCTRL->ADDR.reg = ((uint32_t)pf.row) / 2;
+    NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY|NVMCTRL_CTRLA_CMD_ER;
+    while(!NVMCTRL->INTFLAG.bit.READY);
+}
+
+static void write_snapshot (const powerfail_snapshot_t *snapshot)
+{
+    uint32_t words = sizeof(powerfail_snapshot_t) / sizeof(uint32_t), *dest = pf.row;
+    const uint32_t *src = (const uint32_t *)snapshot;
+
+    while(!NVMCTRL->INTFLAG.bit.READY);
+
+    NVMCTRL->CTRLB.bit.MANW = 1;
+
+    NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY|NVMCTRL_CTRLA_CMD_PBC;
+    while(!NVMCTRL->INTFLAG.bit.READY);
+
+    do {
+        *dest++ = *src++;
+    } while(--words);
+
+    NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY|NVMCTRL_CTRLA_CMD_WP;
+    while(!NVMCTRL->INTFLAG.bit.READY);
+}
+
+static void report_snapshot_found (void *data)
+{
+    report_message("Power fail snapshot found, use $PF=RESUME to restore position or $PF=CLEAR and home", Message_Warning);
+}
+
+static status_code_t powerfail_command (sys_state_t state, char *args)
+{
+    uint_fast8_t idx;
+
+    if(!snapshot_valid())
+        return Status_InvalidStatement;
+
+    powerfail_snapshot_t *snapshot = stored_snapshot();
+
+    if(args == NULL) {
+        hal.stream.write("[PF:");
+        for(idx = 0; idx < N_AXIS; idx++) {
+            hal.stream.write(ftoa((float)snapshot->position[idx] / settings.axis[idx].steps_per_mm, N_DECIMAL_COORDVALUE_MM));
+            hal.stream.write(",");
+        }
+        hal.stream.write(uitoa((uint32_t)snapshot->line_number));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(snapshot->file_offset));
+        hal.stream.write("]" ASCII_EOL);
+    } else if(!strcmp(args, "RESUME")) {
+        if(!(state == STATE_IDLE || state == STATE_ALARM))
+            return Status_IdleError;
+        if(!settings_read_coord_data((coord_system_id_t)snapshot->coord_system, &gc_state.modal.coord_system.xyz))
+            return Status_SettingReadFail;
+        gc_state.modal.coord_system.id = (coord_system_id_t)snapshot->coord_system;
+        gc_state.modal.motion = (motion_mode_t)snapshot->motion;
+        gc_state.modal.plane_select = (plane_select_t)snapshot->plane;
+        gc_state.modal.units_imperial = snapshot->units_imperial;
+        gc_state.modal.distance_incremental = snapshot->distance_incremental;
+        gc_state.modal.feed_mode = (feed_mode_t)snapshot->feed_mode;
+        gc_state.feed_rate = snapshot->feed_rate;
+        system_flag_wco_change();
+        memcpy(sys.position, snapshot->position, sizeof(sys.position));
+        sys.homed.mask = 0;
+        plan_sync_position();
+        gc_sync_position();
+        if(((spindle_state_t){ .value = snapshot->spindle }).on || snapshot->coolant)
+            report_message("Spindle or coolant was on at power fail, restart before resuming", Message_Warning);
+        erase_row();
+    } else if(!strcmp(args, "CLEAR"))
+        erase_row();
+    else
+        return Status_InvalidStatement;
+
+    return Status_OK;
+}
+
+void powerfail_set_offset_handler (powerfail_get_offset_ptr handler)
+{
+    pf.get_offset = handler;
+}
+
+// Reserves the flash row below the settings storage and arms BOD33
+void powerfail_init (void *nvs_addr)
+{
+    static const sys_command_t pf_command_list[] = {
+        {"PF", powerfail_command, {0}, { .str = "show, RESUME or CLEAR power fail snapshot" } }
+    };
+
+    static sys_commands_t pf_commands = {
+        .n_commands = sizeof(pf_command_list) / sizeof(sys_command_t),
+        .commands = pf_command_list
+    };
+
+    pf.page_size = 8 << NVMCTRL->PARAM.bit.PSZ;
+    pf.row_size = pf.page_size * 4;
+    pf.row = (uint32_t *)(((uint32_t)nvs_addr & ~(pf.row_size - 1)) - pf.row_size);
+
+    if(snapshot_valid())
+        protocol_enqueue_foreground_task(report_snapshot_found, NULL);
+    else if(!row_erased())
+        erase_row();
+
+    system_register_commands(&pf_commands);
+
+    // Switch BOD33 from reset to interrupt action
+    SYSCTRL->BOD33.bit.ENABLE = 0;
+    while(!SYSCTRL->PCLKSR.bit.B33SRDY);
+    SYSCTRL->BOD33.reg = SYSCTRL_BOD33_LEVEL(POWERFAIL_BOD_LEVEL)|SYSCTRL_BOD33_ACTION_INT|SYSCTRL_BOD33_HYST;
+    SYSCTRL->BOD33.bit.ENABLE = 1;
+    while(!SYSCTRL->PCLKSR.bit.BOD33RDY);
+
+    SYSCTRL->INTFLAG.reg = SYSCTRL_INTFLAG_BOD33DET;
+    SYSCTRL->INTENSET.reg = SYSCTRL_INTENSET_BOD33DET;
+
+    IRQRegister(SYSCTRL_IRQn, BOD_IRQHandler);
+    NVIC_SetPriority(SYSCTRL_IRQn, 0);
+    NVIC_EnableIRQ(SYSCTRL_IRQn);
+}
+
+static void BOD_IRQHandler (void)
+{
+    SYSCTRL->INTFLAG.reg = SYSCTRL_INTFLAG_BOD33DET;
+    SYSCTRL->INTENCLR.reg = SYSCTRL_INTENCLR_BOD33DET;
+
+    hal.stepper.go_idle(false);
+
+    powerfail_snapshot_t *snapshot = &pf.snapshot;
+    plan_block_t *block = plan_get_current_block();
+
+    snapshot->magic = SNAPSHOT_MAGIC;
+    memcpy(snapshot->position, sys.position, sizeof(snapshot->position));
+    snapshot->line_number = block ? block->line_number : gc_state.line_number;
+    snapshot->file_offset = pf.get_offset ? pf.get_offset() : 0;
+    snapshot->feed_rate = gc_state.feed_rate;
+    snapshot->motion = (uint8_t)gc_state.modal.motion;
+    snapshot->coord_system = (uint8_t)gc_state.modal.coord_system.id;
+    snapshot->plane = (uint8_t)gc_state.modal.plane_select;
+    snapshot->units_imperial = gc_state.modal.units_imperial;
+    snapshot->distance_incremental = gc_state.modal.distance_incremental;
+    snapshot->feed_mode = (uint8_t)gc_state.modal.feed_mode;
+    snapshot->spindle = gc_state.modal.spindle.state.value;
+    snapshot->coolant = gc_state.modal.coolant.value;
+    snapshot->checksum = snapshot_checksum(snapshot);
+
+    if(row_erased())
+        write_snapshot(snapshot);
+
+    // The supply may recover before dropping below the reset level, abort so the controller
+    // does not carry on with a motion the steppers no longer follow.
+    mc_reset();
+    system_set_exec_alarm(Alarm_AbortCycle);
+
+    // Hold in reset until power is restored
+    SYSCTRL->BOD33.bit.ENABLE = 0;
+    while(!SYSCTRL->PCLKSR.bit.B33SRDY);
+    SYSCTRL->BOD33.bit.ACTION = SYSCTRL_BOD33_ACTION_RESET_Val;
+    SYSCTRL->BOD33.bit.ENABLE = 1;
+}
+
+#endif // POWERFAIL_ENABLE
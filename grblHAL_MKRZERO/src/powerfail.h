@@ -0,0 +1,34 @@
+/*
+
+  powerfail.h - brown-out detection with machine state snapshot to flash
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _POWERFAIL_H_
+#define _POWERFAIL_H_
+
+#include <stdint.h>
+
+typedef uint32_t (*powerfail_get_offset_ptr)(void);
+
+void powerfail_init (void *nvs_addr);
+void powerfail_set_offset_handler (powerfail_get_offset_ptr handler);
+
+#endif
@@ -0,0 +1,206 @@
+/*
+
+  ppi.c - laser PPI (pulses per inch) mode, software counted step events trigger hardware timed pulses
+
+  When enabled the spindle PWM timer is switched from continuous PWM to one-shot mode and outputs a
+  laser pulse of fixed length each time it is triggered via an EVSYS software event. The pulse start
+  handler counts step events along the X/Y path in the stepper interrupt and triggers a pulse every
+  1/PPI inch, so the pulse density is independent of the feed rate and stays constant during
+  acceleration. The pulse output is armed when the spindle (laser) is on with a non-zero S word,
+  the S value does not affect power.
+
+  Settings:
+    $454: pulses per inch, 0 to disable and use continuous PWM.
+    $455: pulse length, microseconds.
+
+  NOTE: step outputs cannot be routed to the EIC as the pins would then be disconnected from the
+        port. Counting is thus done by the CPU in the stepper interrupt, adding a few cycles to each
+        tick while armed. Only the pulse itself is timed by hardware.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if LASER_PPI_ENABLE
+
+#include <math.h>
+
+#include "ppi.h"
+
+#include "grbl/stepper.h"
+#include "grbl/nvs_buffer.h"
+#include "grbl/nuts_bolts.h"
+
+#define PPI_TIMER_CLK 1000000UL // GCLK7 (16 MHz) with DIV16 prescaler, 1 tick per microsecond
+
+typedef struct {
+    uint16_t ppi;
+    uint16_t pulse_length;
+} ppi_settings_t;
+
+static ppi_settings_t ppi_settings;
+static nvs_address_t nvs_address;
+
+static struct {
+    bool enabled;           // timer configured for PPI pulses
+    volatile bool armed;    // laser on
+    bool xy_motion;         // block being executed moves X and/or Y
+    uint32_t count;         // step events since last pulse, in 1/8 step units
+    uint32_t threshold;     // step events per pulse, in 1/8 step units
+    uint32_t swevt;         // EVSYS CHANNEL register value for a software event
+} ppi = {0};
+
+// Called from the driver pulse start functions.
+// The stepper interrupt runs 2^level ticks per step event at AMASS level, so every tick of a block
+// with X or Y motion is weighted by level to count step events, max level is 3.
+void ppi_pulse_start (stepper_t *stepper)
+{
+    if(!ppi.armed || stepper->exec_block == NULL || stepper->exec_segment == NULL)
+        return;
+
+    if(stepper->new_block || ppi.threshold == 0) {
+
+        st_block_t *block = stepper->exec_block;
+
+        ppi.xy_motion = !!(block->steps[X_AXIS] || block->steps[Y_AXIS]);
+
+        // Step events per mm of the X/Y path, steps_per_mm is for the full path including Z.
+        if(ppi.xy_motion) {
+            float steps_per_mm = block->steps_per_mm;
+            if(block->steps[Z_AXIS]) {
+                float x = (float)block->steps[X_AXIS] / settings.axis[X_AXIS].steps_per_mm,
+                      y = (float)block->steps[Y_AXIS] / settings.axis[Y_AXIS].steps_per_mm;
+                steps_per_mm = (float)block->step_event_count / sqrtf(x * x + y * y);
+            }
+            if((ppi.threshold = (uint32_t)(steps_per_mm * 25.4f * 8.0f / (float)ppi_settings.ppi)) == 0)
+                ppi.threshold = 1;
+        }
+    }
+
+    if(ppi.xy_motion && (ppi.count += 8 >> stepper->exec_segment->amass_level) >= ppi.threshold) {
+        ppi.count -= ppi.threshold;
+        EVSYS->CHANNEL.reg = ppi.swevt;
+    }
+}
+
+// Called from the driver spindle speed handler, returns true if the spindle PWM timer is in PPI mode
+bool ppi_arm (bool on)
+{
+    if(ppi.enabled && ppi.armed != on) {
+        ppi.count = 0;
+        ppi.threshold = 0; // Recomputed from the block being executed
+        ppi.armed = on;
+    }
+
+    return ppi.enabled;
+}
+
+// Called by spindleConfig() after the spindle PWM timer has been set up for continuous PWM.
+// In PPI mode the timer counts down once from PER to zero on each event, the output is high
+// while COUNT < CC.
+void ppi_configure (void)
+{
+    bool enable = ppi_settings.ppi > 0 && ppi_settings.pulse_length > 0;
+
+    if(!(enable || ppi.enabled))
+        return;
+
+    ppi.armed = false;
+
+    SPINDLE_PWM_TIMER->CTRLA.bit.ENABLE = 0;
+    while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.ENABLE);
+
+    if((ppi.enabled = enable)) {
+        SPINDLE_PWM_TIMER->CTRLA.bit.PRESCALER = TCC_CTRLA_PRESCALER_DIV16_Val;
+        SPINDLE_PWM_TIMER->EVCTRL.reg = TCC_EVCTRL_TCEI0|TCC_EVCTRL_EVACT0_RETRIGGER;
+        SPINDLE_PWM_TIMER->CTRLBSET.reg = TCC_CTRLBSET_DIR|TCC_CTRLBSET_ONESHOT;
+        while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.CTRLB);
+        SPINDLE_PWM_TIMER->PER.bit.PER = ppi_settings.pulse_length;
+        while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.PER);
+        SPINDLE_PWM_TIMER->CC[SPINDLE_PWM_CCREG].bit.CC = ppi_settings.pulse_length;
+        while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.CC2);
+    } else {
+        SPINDLE_PWM_TIMER->EVCTRL.reg = 0;
+        SPINDLE_PWM_TIMER->CTRLBCLR.reg = TCC_CTRLBCLR_DIR|TCC_CTRLBCLR_ONESHOT;
+        while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.CTRLB);
+    }
+
+    SPINDLE_PWM_TIMER->CTRLA.bit.ENABLE = 1;
+    while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.ENABLE);
+
+    if(ppi.enabled) {
+        SPINDLE_PWM_TIMER->CTRLBSET.reg = TCC_CTRLBSET_CMD_STOP;
+        while(SPINDLE_PWM_TIMER->SYNCBUSY.bit.CTRLB);
+    }
+}
+
+static const setting_detail_t ppi_setting_details[] = {
+    { Setting_UserDefined_4, Group_Spindle, "Laser PPI", "pulse/inch", Format_Int16, "####0", "0", "10000", Setting_NonCore, &ppi_settings.ppi, NULL, NULL },
+    { Setting_UserDefined_5, Group_Spindle, "Laser PPI pulse length", "microseconds", Format_Int16, "####0", "1", "60000", Setting_NonCore, &ppi_settings.pulse_length, NULL, NULL }
+};
+
+// The timer is reconfigured by spindleConfig() when the core calls settings_changed() after saving
+static void ppi_settings_save (void)
+{
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&ppi_settings, sizeof(ppi_settings_t), true);
+}
+
+static void ppi_settings_restore (void)
+{
+    ppi_settings.ppi = 0;
+    ppi_settings.pulse_length = 1000;
+
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&ppi_settings, sizeof(ppi_settings_t), true);
+}
+
+static void ppi_settings_load (void)
+{
+    if(hal.nvs.memcpy_from_nvs((uint8_t *)&ppi_settings, nvs_address, sizeof(ppi_settings_t), true) != NVS_TransferResult_OK)
+        ppi_settings_restore();
+}
+
+void ppi_init (void)
+{
+    static setting_details_t setting_details = {
+        .settings = ppi_setting_details,
+        .n_settings = sizeof(ppi_setting_details) / sizeof(setting_detail_t),
+        .save = ppi_settings_save,
+        .load = ppi_settings_load,
+        .restore = ppi_settings_restore
+    };
+
+    PM->APBCMASK.reg |= PM_APBCMASK_EVSYS;
+
+    // Software events require a resynchronized path and thus a clock for the channel
+    GCLK->CLKCTRL.reg = (uint16_t)(GCLK_CLKCTRL_CLKEN|GCLK_CLKCTRL_GEN_GCLK0|GCLK_CLKCTRL_ID(GCLK_CLKCTRL_ID_EVSYS_0_Val + EVSYS_CH_LASER_PPI));
+    while(GCLK->STATUS.bit.SYNCBUSY);
+
+    ppi.swevt = EVSYS_CHANNEL_CHANNEL(EVSYS_CH_LASER_PPI)|EVSYS_CHANNEL_PATH_RESYNCHRONIZED|EVSYS_CHANNEL_EDGSEL_RISING_EDGE;
+
+    EVSYS->USER.reg = (uint16_t)(EVSYS_USER_USER(EVSYS_ID_USER_TCC0_EV_0)|EVSYS_USER_CHANNEL(EVSYS_CH_LASER_PPI + 1));
+    EVSYS->CHANNEL.reg = ppi.swevt;
+
+    ppi.swevt |= EVSYS_CHANNEL_SWEVT;
+
+    if((nvs_address = nvs_alloc(sizeof(ppi_settings_t))))
+        settings_register(&setting_details);
+}
+
+#endif // LASER_PPI_ENABLE
@@ -0,0 +1,34 @@
+/*
+
+  ppi.h - laser PPI (pulses per inch) mode, software counted step events trigger hardware timed pulses
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _PPI_H_
+#define _PPI_H_
+
+#include "grbl/hal.h"
+
+void ppi_init (void);
+void ppi_configure (void);
+bool ppi_arm (bool on);
+void ppi_pulse_start (stepper_t *stepper);
+
+#endif
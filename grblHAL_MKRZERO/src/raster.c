@@ -0,0 +1,281 @@
+/*
+
+  raster.c - laser raster engraving with per pixel power output from the step interrupt
+
+  A scanline of 8-bit power values is loaded with $RASTER=<base64 data>, repeated commands append to it.
+  $RASTERGO=<X steps per pixel>[,<lead-in X steps>] queues the scanline, one pixel is then output every
+  <X steps per pixel> X axis steps after the lead-in and the PWM output is set to off after the last pixel.
+  Steps per pixel and lead-in may be non-integer, pixels are then output at the nearest following step.
+  Scanlines are queued without waiting for motion to complete: X steps are counted from the first
+  $RASTERGO of a job, which waits for motion to complete, and the lead-in of a scanline is counted from
+  the end of the previous one. Up to RASTER_LINES - 1 scanlines may be queued while the next one is loaded,
+  $RASTERGO waits for a free slot. A scanline queued after its first pixel has been passed is dropped
+  and counted as missed.
+  $RASTERGO=0 waits for motion to complete and ends the job, $RASTER reports
+  [RASTER:<pixels loaded>,<scanlines queued>,<scanlines missed>].
+
+  Use M3 with a non-zero S word for the scan moves, the laser enable is controlled by the spindle state.
+
+  NOTE: X step outputs cannot be routed to the EIC as the pin would then be disconnected from the port,
+        pixels are written to the spindle PWM CCBUF register from the pulse start handler instead.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if RASTER_ENABLE
+
+#include <string.h>
+
+#include "raster.h"
+
+#include "grbl/protocol.h"
+#include "grbl/nuts_bolts.h"
+
+#ifndef RASTER_MAX_PIXELS
+#define RASTER_MAX_PIXELS 256
+#endif
+#ifndef RASTER_LINES
+#define RASTER_LINES 3 // Number of scanline buffers, one is used for loading
+#endif
+
+// Pixel positions are kept in 16.16 fixed point so non-integer steps per pixel do not accumulate errors.
+typedef struct {
+    uint16_t length;            // pixels
+    uint32_t next;              // job X step of next pixel, integer part
+    uint32_t next_frac;         // job X step of next pixel, fractional part in 1/65536 steps
+    uint32_t steps_per_pixel;   // 16.16 fixed point
+    uint32_t duty[RASTER_MAX_PIXELS]; // PWM compare values
+} scanline_t;
+
+static scanline_t line[RASTER_LINES];
+
+static struct {
+    volatile bool active;           // job started
+    volatile uint_fast8_t head;     // scanline being loaded, queued scanlines are tail to head - 1
+    volatile uint_fast8_t tail;     // scanline being output
+    volatile uint16_t pixel;        // next pixel of scanline being output
+    volatile uint32_t step;         // X steps since job start
+    volatile uint32_t missed;       // scanlines dropped
+    uint64_t end;                   // job X step after the last pixel of the last queued scanline, 16.16 fixed point
+    uint16_t length;                // pixels loaded
+    spindle_pwm_t *pwm;
+} raster = {0};
+
+static inline void pwm_set (uint32_t value)
+{
+    SPINDLE_PWM_TIMER->CCB[SPINDLE_PWM_CCREG].reg = value;
+}
+
+// Called from the driver pulse start functions
+void raster_pulse_start (stepper_t *stepper)
+{
+    if(raster.active && stepper->step_outbits.x) {
+
+        uint32_t step = ++raster.step;
+
+        if(raster.tail != raster.head) {
+
+            scanline_t *scanline = &line[raster.tail];
+
+            if(step == scanline->next) {
+                scanline->next_frac += scanline->steps_per_pixel;
+                scanline->next += scanline->next_frac >> 16;
+                scanline->next_frac &= 0xFFFF;
+                if(raster.pixel < scanline->length)
+                    pwm_set(scanline->duty[raster.pixel++]);
+                else {
+                    pwm_set(raster.pwm->off_value);
+                    raster.pixel = 0;
+                    raster.tail = (raster.tail + 1) % RASTER_LINES;
+                }
+            } else if((int32_t)(step - scanline->next) > 0) {
+                // Queued too late
+                if(raster.pixel)
+                    pwm_set(raster.pwm->off_value);
+                raster.missed++;
+                raster.pixel = 0;
+                raster.tail = (raster.tail + 1) % RASTER_LINES;
+            }
+        }
+    }
+}
+
+static void raster_stop (void)
+{
+    if(raster.pixel)
+        pwm_set(raster.pwm->off_value);
+
+    raster.active = false;
+    raster.tail = raster.head;
+    raster.pixel = 0;
+    raster.length = 0;
+}
+
+static int8_t base64_value (char c)
+{
+    if(c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if(c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if(c >= '0' && c <= '9')
+        return c - '0' + 52;
+    if(c == '+')
+        return 62;
+    if(c == '/')
+        return 63;
+
+    return -1;
+}
+
+// Appends base64 encoded pixels to the scanline
+static status_code_t raster_load (sys_state_t state, char *args)
+{
+    if(args == NULL) {
+        hal.stream.write("[RASTER:");
+        hal.stream.write(uitoa(raster.length));
+        hal.stream.write(",");
+        hal.stream.write(uitoa((raster.head + RASTER_LINES - raster.tail) % RASTER_LINES));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(raster.missed));
+        hal.stream.write("]" ASCII_EOL);
+
+        return Status_OK;
+    }
+
+    uint32_t bits = 0, range = raster.pwm->max_value - raster.pwm->min_value;
+    uint_fast8_t nbits = 0;
+    uint16_t length = raster.length;
+    uint32_t *duty = line[raster.head].duty;
+    uint8_t pixel;
+    int8_t value;
+
+    while(*args && *args != '=') {
+
+        if((value = base64_value(*args++)) < 0)
+            return Status_InvalidStatement;
+
+        bits = (bits << 6) | value;
+        if((nbits += 6) >= 8) {
+            if(length == RASTER_MAX_PIXELS)
+                return Status_Overflow;
+            nbits -= 8;
+            pixel = (uint8_t)(bits >> nbits);
+            duty[length++] = pixel ? raster.pwm->min_value + (pixel * range) / 255 : raster.pwm->off_value;
+        }
+    }
+
+    raster.length = length;
+
+    return Status_OK;
+}
+
+// Queues the scanline, waits for motion to complete if starting a job
+static status_code_t raster_go (sys_state_t state, char *args)
+{
+    uint_fast8_t cc = 0;
+    float steps_per_pixel, lead_in = 0.0f;
+
+    if(args == NULL || !read_float(args, &cc, &steps_per_pixel) || steps_per_pixel < 0.0f)
+        return Status_InvalidStatement;
+
+    if(args[cc] == ',') {
+        cc++;
+        if(!read_float(args, &cc, &lead_in) || lead_in < 0.0f)
+            return Status_InvalidStatement;
+    }
+
+    if(args[cc] != '\0')
+        return Status_InvalidStatement;
+
+    if(steps_per_pixel == 0.0f) {
+        if(raster.active && !protocol_buffer_synchronize())
+            return Status_Reset;
+        raster_stop();
+        return Status_OK;
+    }
+
+    if(raster.length == 0 || steps_per_pixel < 1.0f || steps_per_pixel >= 65536.0f)
+        return Status_InvalidStatement;
+
+    if(!raster.active) {
+        if(!protocol_buffer_synchronize())
+            return Status_Reset;
+        raster.step = raster.end = 0;
+        raster.missed = 0;
+        raster.active = true;
+    }
+
+    // Wait for a free slot
+    while((raster.head + 1) % RASTER_LINES == raster.tail) {
+        if(!protocol_execute_realtime())
+            return Status_Reset;
+    }
+
+    scanline_t *scanline = &line[raster.head];
+
+    uint64_t next = raster.end + (uint64_t)(lead_in * 65536.0f + 0.5f) + (1UL << 16);
+
+    scanline->length = raster.length;
+    scanline->steps_per_pixel = (uint32_t)(steps_per_pixel * 65536.0f + 0.5f);
+    scanline->next = (uint32_t)(next >> 16);
+    scanline->next_frac = (uint32_t)next & 0xFFFF;
+
+    raster.end = next + (uint64_t)scanline->length * scanline->steps_per_pixel;
+    raster.length = 0;
+
+    __DMB(); // scanline has to be complete before it is seen by the pulse start handler
+
+    raster.head = (raster.head + 1) % RASTER_LINES;
+
+    return Status_OK;
+}
+
+static on_reset_ptr on_reset;
+
+static void raster_reset (void)
+{
+    raster_stop();
+
+    if(on_reset)
+        on_reset();
+}
+
+void raster_init (spindle_pwm_t *pwm)
+{
+    static const sys_command_t raster_command_list[] = {
+        {"RASTER", raster_load, {0}, { .str = "append base64 encoded pixel power values to the scanline" } },
+        {"RASTERGO", raster_go, {0}, { .str = "queue scanline, $RASTERGO=<X steps per pixel>[,<lead-in steps>], 0 to end job" } }
+    };
+
+    static sys_commands_t raster_commands = {
+        .n_commands = sizeof(raster_command_list) / sizeof(sys_command_t),
+        .commands = raster_command_list
+    };
+
+    raster.pwm = pwm;
+
+    on_reset = grbl.on_reset;
+    grbl.on_reset = raster_reset;
+
+    system_register_commands(&raster_commands);
+}
+
+#endif // RASTER_ENABLE
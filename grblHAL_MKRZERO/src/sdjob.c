@@ -0,0 +1,412 @@
+/*
+
+  sdjob.c - SD card job source with read-ahead buffer, plain and pre-tokenised jobs
+
+  $JOB=<file> runs a G-code file or a job converted by tools/gcode2tok.c, the format is detected
+  from the file header. $JOB=<file>,<offset> starts the job at the block at file offset <offset>,
+  e.g. the offset stored by a power fail snapshot. The active stream read function is replaced by one returning job data,
+  output and realtime commands still use the active stream.
+
+  File data is read whole sectors at a time into a read-ahead ring buffer of SDJOB_BUFFER_SIZE bytes,
+  larger than the serial input buffer which is not used while a job runs. The buffer is topped up
+  from the realtime loop, i.e. also while the parser waits for room in the planner, so the parser
+  does not wait for the card. hal.rx_buffer_size reports the job buffer size while a job runs.
+
+  $JOB reports job statistics: active, blocks, bytes read, planner starvations and buffer underruns.
+  A planner starvation is counted each time the planner runs empty during a cycle while the job has
+  more data, a buffer underrun when the parser had to wait for a sector read.
+
+  The job is stopped on end of file, on any error status, alarm or reset.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if SDJOB_ENABLE
+
+#include <string.h>
+
+#include "sdjob.h"
+#include "tokjob.h"
+#include "ff.h"
+
+#include "grbl/protocol.h"
+#include "grbl/planner.h"
+#include "grbl/state_machine.h"
+#include "grbl/nuts_bolts.h"
+
+#if POWERFAIL_ENABLE
+#include "powerfail.h"
+#endif
+
+#if USB_MSC_ENABLE
+#include "usb_msc.h"
+#endif
+
+#ifndef SDJOB_BUFFER_SIZE
+#define SDJOB_BUFFER_SIZE 2048 // bytes, must be a power of two and a multiple of 512
+#endif
+
+#define SECTOR_SIZE 512
+
+#if (SDJOB_BUFFER_SIZE & (SDJOB_BUFFER_SIZE - 1)) || SDJOB_BUFFER_SIZE < SECTOR_SIZE
+#error "SDJOB_BUFFER_SIZE must be a power of two and at least 512!"
+#endif
+
+static struct {
+    bool active;
+    bool tokenised;
+    bool file_eof;
+    bool read_error;
+    bool starved;
+    bool midline;               // last character returned was not a LF
+    FIL file;
+    uint32_t head;              // bytes read from file into ring buffer
+    uint32_t tail;              // bytes taken from ring buffer
+    uint32_t offset;            // file offset of the block being read by the parser
+    uint32_t exec_offset;       // file offset of the last complete block handed to the parser
+    volatile uint32_t resume_offset; // file offset of the oldest block that may not have completed
+    uint32_t blocks;
+    uint32_t starvations;
+    uint32_t underruns;
+    uint_fast8_t line_pos;
+    uint_fast8_t line_length;
+    char line[TOKJOB_MAX_LINE + 2];
+    uint8_t buffer[SDJOB_BUFFER_SIZE] __attribute__((aligned(4)));
+} job = {0};
+
+static io_stream_t active_stream;
+static uint32_t rx_buffer_size;
+static on_execute_realtime_ptr on_execute_realtime;
+static on_state_change_ptr on_state_change;
+static on_reset_ptr on_reset;
+static status_message_ptr status_message;
+
+static void report_stats (void)
+{
+    hal.stream.write(uitoa(job.blocks));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(job.head));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(job.starvations));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(job.underruns));
+}
+
+static void job_end (const char *message)
+{
+    if(job.active) {
+
+        job.active = false;
+        f_close(&job.file);
+
+        memcpy(&hal.stream, &active_stream, sizeof(io_stream_t));
+        hal.rx_buffer_size = rx_buffer_size;
+
+        if(message) {
+            hal.stream.write("[MSG:");
+            hal.stream.write(message);
+            hal.stream.write(", ");
+            report_stats();
+            hal.stream.write("]" ASCII_EOL);
+        }
+    }
+}
+
+// Reads the next sector into the ring buffer, head is always sector aligned until end of file.
+static bool read_sector (void)
+{
+    UINT bytes;
+
+    if(f_read(&job.file, &job.buffer[job.head & (SDJOB_BUFFER_SIZE - 1)], SECTOR_SIZE, &bytes) != FR_OK) {
+        job.read_error = true;
+        return false;
+    }
+
+    job.head += bytes;
+    job.file_eof = bytes < SECTOR_SIZE;
+
+    return true;
+}
+
+// Returns the next job file byte or -1 at end of file or on read error
+static int job_getc (void *context)
+{
+    UNUSED(context);
+
+    if(job.head == job.tail) {
+        if(job.file_eof || job.read_error || !read_sector() || job.head == job.tail)
+            return -1;
+        job.underruns++;
+    }
+
+    return job.buffer[job.tail++ & (SDJOB_BUFFER_SIZE - 1)];
+}
+
+static int16_t job_read_tokenised (void)
+{
+    int length;
+
+    if(job.line_pos == job.line_length) {
+
+        if(!job.active)
+            return SERIAL_NO_DATA;
+
+        job.exec_offset = job.offset;
+        job.offset = job.tail;
+
+        if((length = tokjob_decode_block(job_getc, NULL, job.line, sizeof(job.line) - 1)) < 0) {
+            job_end(job.read_error ? "Job file read error" : (length == TOKJOB_END ? "Job completed" : "Job file corrupt"));
+            return SERIAL_NO_DATA;
+        }
+
+        job.line[length++] = ASCII_LF;
+        job.line_length = length;
+        job.line_pos = 0;
+        job.blocks++;
+    }
+
+    return job.line[job.line_pos++];
+}
+
+static int16_t job_read (void)
+{
+    int c;
+
+    if(!job.active)
+        return SERIAL_NO_DATA;
+
+    if((c = job_getc(NULL)) < 0) {
+        job_end(job.read_error ? "Job file read error" : "Job completed");
+        return job.midline ? ASCII_LF : SERIAL_NO_DATA; // terminate last line if no LF at end of file
+    }
+
+    if(!(job.midline = c != ASCII_LF)) {
+        job.exec_offset = job.offset;
+        job.offset = job.tail;
+        job.blocks++;
+    }
+
+    return (int16_t)c;
+}
+
+static uint16_t job_rx_free (void)
+{
+    return (uint16_t)(SDJOB_BUFFER_SIZE - (job.head - job.tail));
+}
+
+#if POWERFAIL_ENABLE
+
+// Called from the brown-out interrupt, returns the file offset to resume from
+static uint32_t job_offset (void)
+{
+    return job.active ? job.resume_offset : 0;
+}
+
+#endif
+
+static void job_execute_realtime (uint_fast16_t state)
+{
+    on_execute_realtime(state);
+
+    if(job.active) {
+
+        // Top up read-ahead buffer, a read error is reported when the parser reaches it
+        if(!(job.file_eof || job.read_error) && SDJOB_BUFFER_SIZE - (job.head - job.tail) >= SECTOR_SIZE)
+            read_sector();
+
+        // The parser reads ahead of motion, the resume offset is only advanced when the planner is
+        // empty. Segments of the last block handed to the parser may then still be executing, so
+        // resuming may repeat that block but does not skip queued moves.
+        if(plan_get_current_block() == NULL)
+            job.resume_offset = job.exec_offset;
+
+        bool starved = state == STATE_CYCLE && plan_get_current_block() == NULL && !((job.file_eof || job.read_error) && job.head == job.tail);
+
+        if(starved && !job.starved)
+            job.starvations++;
+
+        job.starved = starved;
+    }
+}
+
+static status_code_t job_status_message (status_code_t status_code)
+{
+    if(job.active && status_code != Status_OK) {
+        hal.stream.write("[MSG:Job stopped at block ");
+        hal.stream.write(uitoa(job.blocks));
+        hal.stream.write("]" ASCII_EOL);
+        job_end(NULL);
+    }
+
+    return status_message ? status_message(status_code) : status_code;
+}
+
+static void job_state_change (sys_state_t state)
+{
+    if(state & (STATE_ALARM|STATE_ESTOP))
+        job_end("Job aborted");
+
+    if(on_state_change)
+        on_state_change(state);
+}
+
+static void job_reset (void)
+{
+    job_end("Job aborted");
+
+    if(on_reset)
+        on_reset();
+}
+
+// Parses and strips an optional ,<offset> suffix from the filename, returns false if out of range
+static bool get_start_offset (char *args, uint32_t *offset)
+{
+    char *s = strrchr(args, ',');
+    uint64_t value = 0;
+
+    *offset = 0;
+
+    if(s == NULL || s[1] == '\0' || strspn(s + 1, "0123456789") != strlen(s + 1))
+        return true;
+
+    *s++ = '\0';
+
+    while(*s) {
+        if((value = value * 10 + (*s++ - '0')) > UINT32_MAX)
+            return false;
+    }
+
+    *offset = (uint32_t)value;
+
+    return true;
+}
+
+static status_code_t job_command (sys_state_t state, char *args)
+{
+    FRESULT res;
+    uint32_t offset;
+
+    if(args == NULL) {
+        hal.stream.write("[JOB:");
+        hal.stream.write(uitoa(job.active));
+        hal.stream.write(",");
+        report_stats();
+        hal.stream.write("]" ASCII_EOL);
+        return Status_OK;
+    }
+
+    if(!(state == STATE_IDLE || state == STATE_CHECK_MODE) || job.active || hal.stream.type == StreamType_SDCard)
+        return Status_IdleError;
+
+#if USB_MSC_ENABLE
+    if(usb_msc_exposed())
+        return Status_SDMountError;
+#endif
+
+    if(!get_start_offset(args, &offset))
+        return Status_InvalidStatement;
+
+    if((res = f_open(&job.file, args, FA_READ)) != FR_OK)
+        return res == FR_NOT_ENABLED || res == FR_NO_FILESYSTEM || res == FR_NOT_READY ? Status_SDMountError : Status_SDReadError;
+
+    job.head = job.tail = 0;
+    job.file_eof = job.read_error = false;
+
+    if(!read_sector() || job.head == 0) {
+        f_close(&job.file);
+        return job.head == 0 ? Status_SDFileEmpty : Status_SDReadError;
+    }
+
+    if((job.tokenised = job.head >= TOKJOB_HEADER_SIZE && tokjob_check_header(job.buffer)))
+        job.tail = TOKJOB_HEADER_SIZE;
+
+    // The offset must be at a block boundary, a tokenised job reports corrupt data if not.
+    if(offset) {
+
+        if(offset < job.tail || offset >= f_size(&job.file)) {
+            f_close(&job.file);
+            return Status_InvalidStatement;
+        }
+
+        if(offset >= job.head) {
+            job.head = job.tail = offset & ~(SECTOR_SIZE - 1); // keep head sector aligned
+            if(f_lseek(&job.file, job.head) != FR_OK || !read_sector()) {
+                f_close(&job.file);
+                return Status_SDReadError;
+            }
+        }
+
+        job.tail = offset;
+    }
+
+    job.offset = job.exec_offset = job.resume_offset = job.tail;
+    job.line_pos = job.line_length = 0;
+    job.blocks = job.starvations = job.underruns = 0;
+    job.starved = job.midline = false;
+    job.active = true;
+
+    memcpy(&active_stream, &hal.stream, sizeof(io_stream_t));
+    hal.stream.type = StreamType_SDCard;
+    hal.stream.read = job.tokenised ? job_read_tokenised : job_read;
+    hal.stream.get_rx_buffer_free = job_rx_free;
+
+    rx_buffer_size = hal.rx_buffer_size;
+    hal.rx_buffer_size = SDJOB_BUFFER_SIZE;
+
+    return Status_OK;
+}
+
+bool sdjob_active (void)
+{
+    return job.active;
+}
+
+void sdjob_init (void)
+{
+    static const sys_command_t job_command_list[] = {
+        {"JOB", job_command, {0}, { .str = "run G-code or pre-tokenised job from SD card, $JOB=<filename>[,<offset>], $JOB reports job statistics" } }
+    };
+
+    static sys_commands_t job_commands = {
+        .n_commands = sizeof(job_command_list) / sizeof(sys_command_t),
+        .commands = job_command_list
+    };
+
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = job_execute_realtime;
+
+    on_state_change = grbl.on_state_change;
+    grbl.on_state_change = job_state_change;
+
+    on_reset = grbl.on_reset;
+    grbl.on_reset = job_reset;
+
+    status_message = grbl.report.status_message;
+    grbl.report.status_message = job_status_message;
+
+#if POWERFAIL_ENABLE
+    powerfail_set_offset_handler(job_offset);
+#endif
+
+    system_register_commands(&job_commands);
+}
+
+#endif // SDJOB_ENABLE
@@ -0,0 +1,32 @@
+/*
+
+  sdjob.h - SD card job source with read-ahead buffer, plain and pre-tokenised jobs
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _SDJOB_H_
+#define _SDJOB_H_
+
+#include <stdbool.h>
+
+void sdjob_init (void);
+bool sdjob_active (void);
+
+#endif
@@ -23,11 +23,7 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
-#include "Arduino.h"
-
 #include "sam.h"
-#include "variant.h"
-#include "wiring_private.h"
 
 #define PIN_SERIAL1_RX (13ul)
 #define PIN_SERIAL1_TX (14ul)
@@ -39,6 +35,7 @@
 
 #include "driver.h"
 #include "serial.h"
+#include "mcu_pins.h"
 #include "grbl/hal.h"
 #include "grbl/protocol.h"
 
@@ -78,6 +75,28 @@ typedef enum
 static Sercom *sercom = SERCOM5;
 static stream_rx_buffer_t rxbuf = {0};
 static stream_rx_buffer_t txbuf = {0};
+static struct {
+    volatile uint_fast16_t head;
+    volatile uint_fast16_t tail;
+    char data[TX_PRIORITY_BUFFER_SIZE];
+} txpri = {0};
+static tx_stats_t tx_stats = {0};
+
+// Output is queued in two lanes, lanes are switched at line boundaries only.
+// The priority lane is served first when the interrupt handler is at a line boundary.
+// A nested priority line that cannot be queued while a bulk line is incomplete is moved to the bulk lane.
+typedef struct {
+    bool line_start;    // next character written starts a new line
+    bool priority;      // current line is written to the priority lane
+    uint_fast16_t line_head; // priority lane head at start of the current line
+} tx_writer_t;
+
+static tx_writer_t tx_writer = { .line_start = true };
+static bool tx_bulk_open = false; // the last line written to the bulk lane is not complete
+static volatile struct {
+    bool priority;      // interrupt handler is sending from the priority lane
+    bool midline;       // last character sent was not a LF
+} tx_sender = {0};
 static enqueue_realtime_command_ptr enqueue_realtime_command = protocol_enqueue_realtime_command;
 
 static void SERIAL_IRQHandler (void);
@@ -89,35 +108,35 @@ void initSerClockNVIC (Sercom *sercom)
 
   if(sercom == SERCOM0)
   {
-    clockId = GCM_SERCOM0_CORE;
+    clockId = GCLK_CLKCTRL_ID_SERCOM0_CORE_Val;
     IdNvic = SERCOM0_IRQn;
   }
   else if(sercom == SERCOM1)
   {
-    clockId = GCM_SERCOM1_CORE;
+    clockId = GCLK_CLKCTRL_ID_SERCOM1_CORE_Val;
     IdNvic = SERCOM1_IRQn;
   }
   else if(sercom == SERCOM2)
   {
-    clockId = GCM_SERCOM2_CORE;
+    clockId = GCLK_CLKCTRL_ID_SERCOM2_CORE_Val;
     IdNvic = SERCOM2_IRQn;
   }
   else if(sercom == SERCOM3)
   {
-    clockId = GCM_SERCOM3_CORE;
+    clockId = GCLK_CLKCTRL_ID_SERCOM3_CORE_Val;
     IdNvic = SERCOM3_IRQn;
   }
   #if defined(SERCOM4)
   else if(sercom == SERCOM4)
   {
-    clockId = GCM_SERCOM4_CORE;
+    clockId = GCLK_CLKCTRL_ID_SERCOM4_CORE_Val;
     IdNvic = SERCOM4_IRQn;
   }
   #endif // SERCOM4
   #if defined(SERCOM5)
   else if(sercom == SERCOM5)
   {
-    clockId = GCM_SERCOM5_CORE;
+    clockId = GCLK_CLKCTRL_ID_SERCOM5_CORE_Val;
     IdNvic = SERCOM5_IRQn;
   }
   #endif // SERCOM5
@@ -148,9 +167,9 @@ void initSerClockNVIC (Sercom *sercom)
 //
 static uint16_t serialTxCount (void)
 {
-    uint16_t tail = txbuf.tail;
+    uint16_t tail = txbuf.tail, pri_tail = txpri.tail;
 
-    return BUFCOUNT(txbuf.head, tail, TX_BUFFER_SIZE);
+    return BUFCOUNT(txbuf.head, tail, TX_BUFFER_SIZE) + BUFCOUNT(txpri.head, pri_tail, TX_PRIORITY_BUFFER_SIZE);
 }
 
 //
@@ -198,36 +217,151 @@ static inline bool serialPutCNonBlocking (const char c)
 {
     bool ok;
 
-    if((ok = sercom->USART.INTFLAG.bit.DRE))
+    if((ok = txbuf.head == txbuf.tail && txpri.head == txpri.tail &&
+              (!tx_sender.midline || tx_sender.priority == tx_writer.priority) &&
+               sercom->USART.INTFLAG.bit.DRE)) {
+        tx_sender.priority = tx_writer.priority;
+        tx_sender.midline = c != ASCII_LF;
+        if(!tx_writer.priority)
+            tx_bulk_open = tx_sender.midline;
         sercom->USART.DATA.reg = c;
+    }
+
+    return ok;
+}
+
+//
+// Waits for free space in the output buffer, output from nested calls starts on a new line
+//
+static bool serialTxWait (tx_lane_stats_t *stats)
+{
+    bool ok;
+    tx_writer_t writer = tx_writer;
+
+    stats->waits++;
+    tx_writer.line_start = true;
+    ok = hal.stream_blocking_callback();
+    tx_writer = writer;
 
     return ok;
 }
 
+//
+// Adds a character to the bulk lane, blocks if full
+//
+static bool serialTxBulk (const char c, tx_lane_stats_t *stats)
+{
+    uint16_t next_head = BUFNEXT(txbuf.head, txbuf);            // Get pointer to next free slot in buffer
+
+    while(txbuf.tail == next_head) {                            // While TX buffer full
+        if(!serialTxWait(stats))                                // check if blocking for space,
+            return false;                                       // exit if not (leaves TX buffer in an inconsistent state)
+    }
+
+    txbuf.data[txbuf.head] = c;                                 // Add data to buffer
+    txbuf.head = next_head;                                     // and update head pointer
+    tx_bulk_open = c != ASCII_LF;
+
+    return true;
+}
+
+//
+// Moves the priority line being written to the bulk lane, returns false if not possible.
+// Used when the priority lane is full while the interrupt handler is held midline on a bulk line
+// that an outer writer, blocked in this call chain, has not completed. The handler cannot switch
+// lanes before that line is complete so waiting for priority lane space would never end.
+// The moved line is added after the bulk data queued so far, as output from nested calls always was.
+//
+static bool serialTxDivert (tx_lane_stats_t *stats)
+{
+    char line[TX_PRIORITY_BUFFER_SIZE];
+    uint_fast16_t length = 0, idx;
+
+    __disable_irq();
+
+    if(tx_bulk_open && tx_sender.midline && !tx_sender.priority) {
+        for(idx = tx_writer.line_head; idx != txpri.head; idx = BUFNEXT(idx, txpri))
+            line[length++] = txpri.data[idx];
+        txpri.head = tx_writer.line_head;
+        tx_writer.priority = false;
+    }
+
+    __enable_irq();
+
+    if(tx_writer.priority)
+        return false;
+
+    for(idx = 0; idx < length; idx++) {
+        if(!serialTxBulk(line[idx], stats))
+            return false;
+    }
+
+    return true;
+}
+
 //
 // Writes a character to the serial output stream
 //
 static bool serialPutC (const char c)
 {
-    if(txbuf.head != txbuf.tail || !serialPutCNonBlocking(c)) { // Try to send character without buffering...
+    uint16_t count;
+    tx_lane_stats_t *stats;
+
+    if(tx_writer.line_start) {
+        tx_writer.priority = TX_PRIORITY_LINE(c);
+        tx_writer.line_head = txpri.head;
+    }
+
+    tx_writer.line_start = c == ASCII_LF;
+
+    stats = tx_writer.priority ? &tx_stats.priority : &tx_stats.bulk;
+    stats->bytes++;
+    if(c == ASCII_LF)
+        stats->lines++;
+
+    if(serialPutCNonBlocking(c))                                // Try to send character without buffering...
+        return true;
+
+    if(tx_writer.priority) {
 
-        uint16_t next_head = BUFNEXT(txbuf.head, txbuf);        // .. if not, get pointer to next free slot in buffer
+        uint16_t next_head = BUFNEXT(txpri.head, txpri);
 
-        while(txbuf.tail == next_head) {                        // While TX buffer full
-      //      SERIAL_MODULE->IE |= EUSCI_A_IE_TXIE;             // Enable TX interrupts???
-            if(!hal.stream_blocking_callback())                 // check if blocking for space,
-                return false;                                   // exit if not (leaves TX buffer in an inconsistent state)
+        while(txpri.tail == next_head && tx_writer.priority) {
+            if(!(serialTxDivert(stats) || serialTxWait(stats)))
+                return false;
+            next_head = BUFNEXT(txpri.head, txpri);
         }
 
-        txbuf.data[txbuf.head] = c;                             // Add data to buffer
-        txbuf.head = next_head;                                 // and update head pointer
+        if(tx_writer.priority) {
+            txpri.data[txpri.head] = c;
+            txpri.head = next_head;
+            count = BUFCOUNT(next_head, txpri.tail, TX_PRIORITY_BUFFER_SIZE);
+        } else if(serialTxBulk(c, stats))                       // line was moved to the bulk lane
+            count = BUFCOUNT(txbuf.head, txbuf.tail, TX_BUFFER_SIZE);
+        else
+            return false;
 
-        sercom->USART.INTENSET.reg = SERCOM_USART_INTENSET_DRE; // Enable TX interrupts
+    } else {                                                    // .. if not, add to the bulk lane
+
+        if(!serialTxBulk(c, stats))
+            return false;
+
+        count = BUFCOUNT(txbuf.head, txbuf.tail, TX_BUFFER_SIZE);
     }
 
+    if(count > stats->peak)
+        stats->peak = count;
+
+    sercom->USART.INTENSET.reg = SERCOM_USART_INTENSET_DRE;     // Enable TX interrupts
+
     return true;
 }
 
+const tx_stats_t *serialTxStats (void)
+{
+    return &tx_stats;
+}
+
 //
 // Writes a null terminated string to the serial output stream, blocks if buffer full
 //
@@ -311,8 +445,8 @@ const io_stream_t *serialInit (void)
         .set_enqueue_rt_handler = serialSetRtHandler
     };
 
-    pinPeripheral(PIN_SERIAL1_RX, g_APinDescription[PIN_SERIAL1_RX].ulPinType);
-    pinPeripheral(PIN_SERIAL1_TX, g_APinDescription[PIN_SERIAL1_TX].ulPinType);
+    pinMux(PIN_SERIAL1_RX, PORT_PMUX_PMUXE_D_Val); // SERCOM5 PAD3
+    pinMux(PIN_SERIAL1_TX, PORT_PMUX_PMUXE_D_Val); // SERCOM5 PAD2
 
     // sercom->initUART(UART_INT_CLOCK, SAMPLE_RATE_x16, BAUD_RATE);
 
@@ -373,7 +507,7 @@ const io_stream_t *serialInit (void)
 
 
 //
-static void SERIAL_IRQHandler (void)
+static void RAMFUNC SERIAL_IRQHandler (void)
 {
     char data;
 
@@ -400,12 +534,35 @@ static void SERIAL_IRQHandler (void)
     }
     
     if(sercom->USART.INTFLAG.bit.DRE) {
-        uint_fast16_t tail = txbuf.tail;                            // Get buffer pointer
-        if(tail != txbuf.head) {
-            sercom->USART.DATA.reg = (uint16_t)txbuf.data[tail];    // Send a byte from the buffer
-            txbuf.tail = tail = BUFNEXT(tail, txbuf);               // and increment pointer
+
+        bool empty, other_empty;
+
+        if(!tx_sender.midline)                                      // At line boundary,
+            tx_sender.priority = txpri.tail != txpri.head;          // serve priority lane first
+
+        if(tx_sender.priority) {
+            uint_fast16_t tail = txpri.tail;
+            if(tail != txpri.head) {
+                data = txpri.data[tail];
+                sercom->USART.DATA.reg = (uint16_t)data;
+                txpri.tail = tail = BUFNEXT(tail, txpri);
+                tx_sender.midline = data != ASCII_LF;
+            }
+            empty = tail == txpri.head;
+            other_empty = txbuf.tail == txbuf.head;
+        } else {
+            uint_fast16_t tail = txbuf.tail;                        // Get buffer pointer
+            if(tail != txbuf.head) {
+                data = txbuf.data[tail];
+                sercom->USART.DATA.reg = (uint16_t)data;            // Send a byte from the buffer
+                txbuf.tail = tail = BUFNEXT(tail, txbuf);           // and increment pointer
+                tx_sender.midline = data != ASCII_LF;
+            }
+            empty = tail == txbuf.head;
+            other_empty = txpri.tail == txpri.head;
         }
-        if (tail == txbuf.head)                                     // Turn off TX interrupt
-            sercom->USART.INTENCLR.reg = SERCOM_USART_INTENCLR_DRE; // when buffer empty
+
+        if(empty && (tx_sender.midline || other_empty))             // Turn off TX interrupt when nothing
+            sercom->USART.INTENCLR.reg = SERCOM_USART_INTENCLR_DRE; // can be sent, it is reenabled by the writer
     }
 }
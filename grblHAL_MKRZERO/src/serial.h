@@ -34,7 +34,25 @@
 #define RX_BUFFER_HWM 900
 #define RX_BUFFER_LWM 300
 
+#define TX_PRIORITY_BUFFER_SIZE 256 // must be a power of 2
+
+// Lines starting with these characters, realtime reports, alarms and telemetry frames, are sent via the priority lane
+#define TX_PRIORITY_LINE(c) ((c) == '<' || (c) == 'A' || (c) == 0x02)
+
+typedef struct {
+    uint32_t lines;
+    uint32_t bytes;
+    uint32_t waits;     // number of times the writer had to wait for free space
+    uint16_t peak;      // max number of bytes queued
+} tx_lane_stats_t;
+
+typedef struct {
+    tx_lane_stats_t bulk;
+    tx_lane_stats_t priority;
+} tx_stats_t;
+
 const io_stream_t *serialInit (void);
+const tx_stats_t *serialTxStats (void);
 
 void initSerClockNVIC (Sercom *sercom);
 
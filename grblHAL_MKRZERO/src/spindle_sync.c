@@ -0,0 +1,264 @@
+/*
+
+  spindle_sync.c - spindle position feedback for spindle synchronized motion
+
+  Index and encoder pulse inputs are routed by EVSYS from the EIC to TCC2 capture channels 0 and 1,
+  capture and overflow interrupts extend the timestamps to 32 bits and keep revolution time, counts and errors.
+  RPM and angular position are calculated from these on request by the core.
+  The pulse input is optional, pulses per revolution is set by $38 and the index is used alone if 0.
+
+  When the core starts synchronized motion (reset_data followed by angular position requests) the reference
+  revolution time is latched. The stepper tick period is then scaled by actual / reference revolution time,
+  updated on each index and pulse and when the spindle slows down between them, so the axis follows
+  spindle speed dips and the thread stays in phase. Remaining phase error is corrected by the core.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if SPINDLE_SYNC_ENABLE
+
+#include "spindle_sync.h"
+#include "mcu_pins.h"
+
+#define SYNC_TIMER          TCC2
+#define SYNC_TIMER_IRQn     TCC2_IRQn
+#define SYNC_TIMER_CLK      (24000000UL / 16) // GCLK6 with DIV16 prescaler
+#define SYNC_STALL_TIME     (SYNC_TIMER_CLK * 2) // spindle is reported stopped if no index or pulse for 2 seconds
+
+volatile uint32_t spindle_sync_scale = 0;
+
+static spindle_data_t spindle_data = {0};
+
+static struct {
+    volatile uint32_t overflows;
+    volatile uint32_t index_count;
+    volatile uint32_t pulse_count;
+    volatile uint32_t error_count;
+    volatile uint32_t index_pulses;     // pulse count at last index
+    volatile uint32_t last_index;       // timestamp of last index
+    volatile uint32_t last_pulse;       // timestamp of last pulse
+    volatile uint32_t rev_period;       // timer ticks per revolution, 0 if not known
+    volatile uint32_t pulse_period;     // timer ticks per pulse
+    uint32_t rev_inv;                   // 2^32 / reference revolution period
+    uint16_t ppr;
+    bool armed;
+} sync = {0};
+
+// Extends a 16 bit capture or count value to 32 bits, called with the overflow flag from before the value was read
+static inline uint32_t timestamp (uint16_t count, bool ovf_pending)
+{
+    return ((sync.overflows + (ovf_pending && count < 0x8000 ? 1 : 0)) << 16) | count;
+}
+
+static uint32_t timestamp_now (void)
+{
+    uint32_t count;
+    bool ovf_pending;
+
+    SYNC_TIMER->CTRLBSET.reg = TCC_CTRLBSET_CMD_READSYNC;
+    while(SYNC_TIMER->SYNCBUSY.bit.CTRLB);
+    while(SYNC_TIMER->SYNCBUSY.bit.COUNT);
+    count = SYNC_TIMER->COUNT.reg;
+    ovf_pending = SYNC_TIMER->INTFLAG.bit.OVF;
+
+    return timestamp(count, ovf_pending);
+}
+
+// Called from the capture and overflow interrupt, period is the actual revolution time or a lower bound for it.
+static inline void update_scale (uint32_t period)
+{
+    if(spindle_sync_scale) {
+        uint64_t scale = ((uint64_t)period * sync.rev_inv) >> 16;
+        spindle_sync_scale = scale > (1ULL << 24) ? (1UL << 24) : (uint32_t)scale; // max 256 times slower
+    }
+}
+
+static void SYNC_IRQHandler (void)
+{
+    uint32_t flags = SYNC_TIMER->INTFLAG.reg, now;
+    bool ovf_pending = !!(flags & TCC_INTFLAG_OVF);
+
+    if(flags & TCC_INTFLAG_MC1) {
+
+        SYNC_TIMER->INTFLAG.reg = TCC_INTFLAG_MC1;
+        now = timestamp(SYNC_TIMER->CC[1].reg, ovf_pending);
+
+        sync.pulse_period = now - sync.last_pulse;
+        sync.last_pulse = now;
+        sync.pulse_count++;
+
+        if(sync.ppr)
+            update_scale(sync.pulse_period * sync.ppr);
+    }
+
+    if(flags & TCC_INTFLAG_MC0) {
+
+        SYNC_TIMER->INTFLAG.reg = TCC_INTFLAG_MC0;
+        now = timestamp(SYNC_TIMER->CC[0].reg, ovf_pending);
+
+        if(sync.ppr && sync.index_count && sync.pulse_count - sync.index_pulses != sync.ppr)
+            sync.error_count++;
+
+        sync.rev_period = now - sync.last_index;
+        sync.last_index = now;
+        sync.index_pulses = sync.pulse_count;
+        sync.index_count++;
+
+        if(!sync.ppr)
+            update_scale(sync.rev_period);
+    }
+
+    if(ovf_pending) {
+
+        SYNC_TIMER->INTFLAG.reg = TCC_INTFLAG_OVF;
+        sync.overflows++;
+
+        // Slow the axis down with the spindle when the next index or pulse is late
+        if(spindle_sync_scale) {
+            now = sync.overflows << 16;
+            if(sync.ppr) {
+                if(now - sync.last_pulse > sync.pulse_period)
+                    update_scale((now - sync.last_pulse) * sync.ppr);
+            } else if(now - sync.last_index > sync.rev_period)
+                update_scale(now - sync.last_index);
+        }
+    }
+}
+
+spindle_data_t *spindle_sync_get_data (spindle_data_request_t request)
+{
+    uint32_t now, rev_period, elapsed;
+    float position;
+
+    __disable_irq();
+
+    now = timestamp_now();
+
+    if(sync.ppr) {
+        elapsed = now - sync.last_pulse;
+        rev_period = sync.pulse_period * sync.ppr;
+        position = (float)(sync.pulse_count - sync.index_pulses) / (float)sync.ppr;
+        if(sync.pulse_period)
+            position += (float)(elapsed < sync.pulse_period ? elapsed : sync.pulse_period) / (float)rev_period;
+    } else {
+        elapsed = now - sync.last_index;
+        rev_period = sync.rev_period;
+        position = rev_period ? (float)(elapsed < rev_period ? elapsed : rev_period) / (float)rev_period : 0.0f;
+    }
+
+    spindle_data.index_count = sync.index_count;
+    spindle_data.pulse_count = sync.pulse_count;
+    spindle_data.error_count = sync.error_count;
+
+    __enable_irq();
+
+    if(elapsed > rev_period)
+        rev_period = elapsed;
+
+    spindle_data.rpm = rev_period && elapsed < SYNC_STALL_TIME ? 60.0f * (float)SYNC_TIMER_CLK / (float)rev_period : 0.0f;
+    spindle_data.angular_position = (float)spindle_data.index_count + position;
+
+    // Synchronized motion has started, track spindle speed from now on
+    if(request == SpindleData_AngularPosition && sync.armed) {
+        sync.armed = false;
+        if(sync.rev_inv)
+            spindle_sync_scale = 1UL << 16;
+    }
+
+    return &spindle_data;
+}
+
+void spindle_sync_reset_data (void)
+{
+    uint32_t rev_period;
+
+    __disable_irq();
+
+    sync.ppr = settings.spindle.ppr;
+    sync.index_count = sync.pulse_count = sync.error_count = sync.index_pulses = 0;
+    rev_period = sync.ppr ? sync.pulse_period * sync.ppr : sync.rev_period;
+
+    __enable_irq();
+
+    // Reference revolution time, division done here to keep it out of the interrupt handlers
+    sync.rev_inv = rev_period > 1 ? (uint32_t)(0xFFFFFFFFUL / rev_period) : 0;
+    sync.armed = true;
+}
+
+// Called by the driver when motion stops
+void spindle_sync_stop (void)
+{
+    sync.armed = false;
+    spindle_sync_scale = 0;
+}
+
+// Routes an input to an EVSYS channel via the EIC, event on rising edge
+static void event_input (uint8_t pin, uint8_t channel, uint8_t user)
+{
+    uint32_t extint = mcu_pin[pin].extint, shift = (extint & 0x07) << 2;
+    PortGroup *port = PIN_GROUP(pin);
+
+    port->DIRCLR.reg = PIN_BIT(pin);
+    port->OUTSET.reg = PIN_BIT(pin);
+    port->PINCFG[mcu_pin[pin].pin].reg = (uint8_t)(PORT_PINCFG_INEN|PORT_PINCFG_PULLEN);
+    pinMux(pin, PORT_PMUX_PMUXE_A_Val);
+
+    EIC->INTENCLR.reg = 1 << extint;
+    EIC->CONFIG[extint >> 3].reg = (EIC->CONFIG[extint >> 3].reg & ~(EIC_CONFIG_SENSE0_Msk << shift)) | (EIC_CONFIG_SENSE0_RISE_Val << shift);
+    EIC->EVCTRL.reg |= 1 << extint;
+
+    EVSYS->USER.reg = (uint16_t)(EVSYS_USER_USER(user)|EVSYS_USER_CHANNEL(channel + 1));
+    EVSYS->CHANNEL.reg = EVSYS_CHANNEL_CHANNEL(channel)|EVSYS_CHANNEL_EVGEN(EVSYS_ID_GEN_EIC_EXTINT_0 + extint)|EVSYS_CHANNEL_PATH_ASYNCHRONOUS;
+}
+
+// Called from driver_setup() when the EIC is enabled and the TCC2 clock is available
+void spindle_sync_setup (void)
+{
+    PM->APBCMASK.reg |= PM_APBCMASK_TCC2|PM_APBCMASK_EVSYS;
+
+    sync.ppr = settings.spindle.ppr;
+
+    SYNC_TIMER->CTRLA.bit.ENABLE = 0;
+    while(SYNC_TIMER->SYNCBUSY.bit.ENABLE);
+    SYNC_TIMER->CTRLA.bit.SWRST = 1;
+    while(SYNC_TIMER->SYNCBUSY.bit.SWRST);
+
+    SYNC_TIMER->CTRLA.reg = TCC_CTRLA_PRESCALER_DIV16|TCC_CTRLA_CPTEN0|TCC_CTRLA_CPTEN1;
+    SYNC_TIMER->EVCTRL.reg = TCC_EVCTRL_MCEI0|TCC_EVCTRL_MCEI1;
+    SYNC_TIMER->PER.reg = 0xFFFF;
+    while(SYNC_TIMER->SYNCBUSY.bit.PER);
+
+    event_input(SPINDLE_INDEX_PIN, EVSYS_CH_SPINDLE_INDEX, EVSYS_ID_USER_TCC2_MC_0);
+#ifdef SPINDLE_PULSE_PIN
+    event_input(SPINDLE_PULSE_PIN, EVSYS_CH_SPINDLE_PULSE, EVSYS_ID_USER_TCC2_MC_1);
+#endif
+
+    SYNC_TIMER->INTENSET.reg = TCC_INTENSET_OVF|TCC_INTENSET_MC0|TCC_INTENSET_MC1;
+
+    IRQRegister(SYNC_TIMER_IRQn, SYNC_IRQHandler);
+    NVIC_SetPriority(SYNC_TIMER_IRQn, 1);
+    NVIC_EnableIRQ(SYNC_TIMER_IRQn);
+
+    SYNC_TIMER->CTRLA.bit.ENABLE = 1;
+    while(SYNC_TIMER->SYNCBUSY.bit.ENABLE);
+}
+
+#endif // SPINDLE_SYNC_ENABLE
@@ -0,0 +1,45 @@
+/*
+
+  spindle_sync.h - spindle position feedback for spindle synchronized motion
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _SPINDLE_SYNC_H_
+#define _SPINDLE_SYNC_H_
+
+#include <stdint.h>
+
+#include "grbl/hal.h"
+
+// Stepper tick period scale, actual / reference spindle revolution time in 16.16 fixed point. 0 when not synchronized.
+extern volatile uint32_t spindle_sync_scale;
+
+// Scales the stepper tick period to follow the spindle speed during synchronized motion
+static inline __attribute__((always_inline)) uint32_t spindle_sync_cycles (uint32_t cycles_per_tick)
+{
+    return spindle_sync_scale ? (uint32_t)(((uint64_t)cycles_per_tick * spindle_sync_scale) >> 16) : cycles_per_tick;
+}
+
+void spindle_sync_setup (void);
+void spindle_sync_stop (void);
+spindle_data_t *spindle_sync_get_data (spindle_data_request_t request);
+void spindle_sync_reset_data (void);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+
+  startup_samd21.c - bare metal startup for Atmel SAMD21 ARM processor (Arduino MKRZERO)
+
+  Used instead of the Arduino core when BARE_METAL is enabled.
+  Link with a SAMD21G18A linker script providing the usual ASF section symbols and with the flash origin
+  at 0x2000 to keep the SAM-BA bootloader.
+  The vector table only holds the stack pointer and the reset handler, all other handlers are
+  registered at run time with IRQRegister() after the driver has copied the table to RAM.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if BARE_METAL
+
+extern uint32_t _sfixed, _etext, _srelocate, _erelocate, _szero, _ezero, _estack;
+
+extern int main (void);
+extern void __libc_init_array (void);
+
+uint32_t SystemCoreClock = 1000000; // OSC8M / 8 after reset
+
+void Dummy_Handler (void)
+{
+    while(true);
+}
+
+// Clocks are set up as by the Arduino core so peripheral code is shared:
+//  GCLK0 - DFLL48M closed loop from XOSC32K, 48 MHz CPU clock
+//  GCLK1 - XOSC32K, 32.768 kHz
+//  GCLK3 - OSC8M, 8 MHz
+void SystemInit (void)
+{
+    NVMCTRL->CTRLB.bit.RWS = NVMCTRL_CTRLB_RWS_HALF_Val; // One wait state required at 48 MHz
+
+    PM->APBAMASK.reg |= PM_APBAMASK_GCLK;
+
+    SYSCTRL->XOSC32K.reg = SYSCTRL_XOSC32K_STARTUP(6)|SYSCTRL_XOSC32K_XTALEN|SYSCTRL_XOSC32K_EN32K;
+    SYSCTRL->XOSC32K.bit.ENABLE = 1;
+    while(!SYSCTRL->PCLKSR.bit.XOSC32KRDY);
+
+    GCLK->CTRL.reg = GCLK_CTRL_SWRST;
+    while(GCLK->CTRL.bit.SWRST && GCLK->STATUS.bit.SYNCBUSY);
+
+    GCLK->GENDIV.reg = GCLK_GENDIV_ID(1);
+    while(GCLK->STATUS.bit.SYNCBUSY);
+    GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(1)|GCLK_GENCTRL_SRC_XOSC32K|GCLK_GENCTRL_GENEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);
+
+    // DFLL48M reference clock
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_DFLL48|GCLK_CLKCTRL_GEN_GCLK1|GCLK_CLKCTRL_CLKEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);
+
+    // ONDEMAND must be cleared before the DFLL registers are written (errata)
+    SYSCTRL->DFLLCTRL.reg = SYSCTRL_DFLLCTRL_ENABLE;
+    while(!SYSCTRL->PCLKSR.bit.DFLLRDY);
+
+    SYSCTRL->DFLLMUL.reg = SYSCTRL_DFLLMUL_CSTEP(31)|SYSCTRL_DFLLMUL_FSTEP(511)|SYSCTRL_DFLLMUL_MUL(48000000 / 32768);
+    while(!SYSCTRL->PCLKSR.bit.DFLLRDY);
+
+    SYSCTRL->DFLLCTRL.reg |= SYSCTRL_DFLLCTRL_MODE|SYSCTRL_DFLLCTRL_WAITLOCK|SYSCTRL_DFLLCTRL_QLDIS;
+    while(!SYSCTRL->PCLKSR.bit.DFLLRDY);
+
+    while(!SYSCTRL->PCLKSR.bit.DFLLLCKC || !SYSCTRL->PCLKSR.bit.DFLLLCKF);
+    while(!SYSCTRL->PCLKSR.bit.DFLLRDY);
+
+    GCLK->GENDIV.reg = GCLK_GENDIV_ID(0);
+    while(GCLK->STATUS.bit.SYNCBUSY);
+    GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(0)|GCLK_GENCTRL_SRC_DFLL48M|GCLK_GENCTRL_IDC|GCLK_GENCTRL_GENEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);
+
+    SYSCTRL->OSC8M.bit.PRESC = SYSCTRL_OSC8M_PRESC_0_Val;
+    SYSCTRL->OSC8M.bit.ONDEMAND = 0;
+
+    GCLK->GENDIV.reg = GCLK_GENDIV_ID(3);
+    while(GCLK->STATUS.bit.SYNCBUSY);
+    GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(3)|GCLK_GENCTRL_SRC_OSC8M|GCLK_GENCTRL_GENEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);
+
+    PM->CPUSEL.reg = PM_CPUSEL_CPUDIV_DIV1;
+    PM->APBASEL.reg = PM_APBASEL_APBADIV_DIV1_Val;
+    PM->APBBSEL.reg = PM_APBBSEL_APBBDIV_DIV1_Val;
+    PM->APBCSEL.reg = PM_APBCSEL_APBCDIV_DIV1_Val;
+
+    SystemCoreClock = 48000000;
+
+    // Peripheral bus clocks otherwise enabled by the Arduino core init()
+    PM->APBCMASK.reg |= PM_APBCMASK_SERCOM2|PM_APBCMASK_SERCOM4|PM_APBCMASK_SERCOM5|
+                         PM_APBCMASK_TCC0|PM_APBCMASK_TCC1|PM_APBCMASK_TCC2|PM_APBCMASK_TC3;
+}
+
+void Reset_Handler (void)
+{
+    uint32_t *src = &_etext, *dest = &_srelocate;
+
+    if(src != dest) while(dest < &_erelocate)
+        *dest++ = *src++;
+
+    for(dest = &_szero; dest < &_ezero;)
+        *dest++ = 0;
+
+    SCB->VTOR = (uint32_t)&_sfixed & SCB_VTOR_TBLOFF_Msk;
+
+    SystemInit();
+
+    __libc_init_array();
+
+    main();
+
+    while(true);
+}
+
+__attribute__ ((section(".isr_vector"), used))
+const void *exception_table[16 + PERIPH_COUNT_IRQn] = {
+    [0] = (void *)&_estack,
+    [1] = (void *)Reset_Handler,
+    [2 ... 16 + PERIPH_COUNT_IRQn - 1] = (void *)Dummy_Handler
+};
+
+#endif // BARE_METAL
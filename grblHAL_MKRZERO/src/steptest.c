@@ -0,0 +1,234 @@
+/*
+
+  steptest.c - on-target step rate stress test
+
+  $STEPTEST runs the driver stepper interrupt at increasing step rates on all axes with a synthetic
+  core callback, emulating the Bresenham and AMASS work done by the core per tick.
+  For each AMASS level it is run with the configured pulse output and with outputs masked,
+  the motor drivers are kept disabled throughout. Position may then be lost, the homed state is
+  cleared and the stepper subsystem reset when done.
+  A step rate is sustainable when no tick overruns and the interrupt completes within 3/4 of the
+  tick period, leaving headroom for other interrupts and the foreground.
+  Reports one line per level and mode: [STEPTEST:<mode>,<AMASS level>,<max step rate>,<ISR time ns>,<mean latency ns>]
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if STEPTEST_ENABLE
+
+#include <string.h>
+
+#include "steptest.h"
+
+#include "grbl/stepper.h"
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+#include "grbl/nuts_bolts.h"
+
+#define STEPTEST_RATE_MIN    1000    // Hz, step rate the search starts at
+#define STEPTEST_RATE_MAX    250000  // Hz, step rate the search ends at
+#define STEPTEST_TIME        20      // ms, run time per step rate
+#define STEPTEST_EVENT_COUNT (1UL << 16)
+
+static struct {
+    stepper_t st;
+    uint32_t steps;             // per axis steps per tick, emulates AMASS
+    uint32_t counter[N_AXIS];
+    uint32_t step_events;
+    uint32_t ticks;             // ticks left to run
+    uint32_t max_time;          // longest time to callback exit, timer ticks
+    uint32_t latency;           // sum of callback entry times, timer ticks
+    uint32_t samples;
+    bool masked;
+    bool aborted;
+    volatile bool running;
+    volatile bool overrun;
+} test;
+
+static inline uint32_t timer_count (void)
+{
+    STEPPER_TIMER->COUNT32.READREQ.reg = TC_READREQ_RREQ|TC_READREQ_ADDR(TC_COUNT32_COUNT_OFFSET);
+    while(STEPPER_TIMER->COUNT32.STATUS.bit.SYNCBUSY);
+
+    return STEPPER_TIMER->COUNT32.COUNT.reg;
+}
+
+// Replaces the core stepper interrupt callback while the test runs
+static void RAMFUNC steptest_tick (void)
+{
+    if(!test.running)
+        return;
+
+    uint32_t entry = timer_count(), exit;
+
+    if(!test.masked)
+        hal.stepper.pulse_start(&test.st);
+
+    test.st.dir_change = false;
+    test.st.step_outbits.value = 0;
+
+    uint_fast8_t idx = N_AXIS;
+    do {
+        idx--;
+        if((test.counter[idx] += test.steps) > STEPTEST_EVENT_COUNT) {
+            test.counter[idx] -= STEPTEST_EVENT_COUNT;
+            test.st.step_outbits.value |= bit(idx);
+        }
+    } while(idx);
+
+    // Reverse every 64 steps to exercise the direction change path
+    if(test.st.step_outbits.value && !(++test.step_events & 0x3F)) {
+        test.st.dir_outbits.value ^= AXES_BITMASK;
+        test.st.dir_change = true;
+    }
+
+    exit = timer_count();
+
+    test.samples++;
+    test.latency += entry;
+    if(exit > test.max_time)
+        test.max_time = exit;
+
+    if((test.overrun = STEPPER_TIMER->COUNT32.INTFLAG.bit.MC0) || --test.ticks == 0) {
+        hal.stepper.go_idle(false);
+        test.running = false;
+    }
+}
+
+// Returns highest sustainable step rate for the AMASS level, 0 if none.
+static uint32_t steptest_run (uint_fast8_t amass_level, bool masked, uint32_t *isr_time, uint32_t *latency)
+{
+    uint32_t rate = STEPTEST_RATE_MIN, best = 0;
+
+    test.masked = masked;
+    test.steps = STEPTEST_EVENT_COUNT >> amass_level;
+
+    while(rate <= STEPTEST_RATE_MAX) {
+
+        uint_fast8_t idx = N_AXIS;
+        uint32_t tick_rate = rate << amass_level, cycles = hal.f_step_timer / tick_rate;
+
+        memset(&test.st, 0, sizeof(stepper_t));
+        do {
+            test.counter[--idx] = STEPTEST_EVENT_COUNT >> 1;
+        } while(idx);
+        test.ticks = tick_rate * STEPTEST_TIME / 1000;
+        test.max_time = test.latency = test.samples = test.step_events = 0;
+        test.overrun = false;
+        test.running = true;
+
+        hal.stepper.wake_up();
+        hal.stepper.enable((axes_signals_t){0}, false);
+        hal.stepper.cycles_per_tick(cycles);
+
+        while(test.running) {
+            if(!protocol_execute_realtime()) {
+                hal.stepper.go_idle(true);
+                test.running = false;
+                test.aborted = true;
+                return best;
+            }
+        }
+
+        if(test.overrun || test.max_time > (cycles * 3) >> 2)
+            break;
+
+        best = rate;
+        *isr_time = test.max_time;
+        *latency = test.latency / test.samples;
+        rate += rate >> 2;
+    }
+
+    return best;
+}
+
+static status_code_t steptest_command (sys_state_t state, char *args)
+{
+    if(args)
+        return Status_InvalidStatement;
+
+    if(state != STATE_IDLE)
+        return Status_IdleError;
+
+    uint_fast8_t level = 0, max_level = 0, mode;
+    stepper_interrupt_callback_ptr interrupt_callback = hal.stepper.interrupt_callback;
+
+#ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+    max_level = hal.driver_cap.amass_level;
+#endif
+
+#if STEP_DUAL_EDGE
+    const char *pulse_mode = "DEDGE";
+#else
+    const char *pulse_mode = settings.steppers.pulse_delay_microseconds > 0.0f ? "DELAYED" : "PULSE";
+#endif
+
+    hal.stepper.interrupt_callback = steptest_tick;
+    test.aborted = false;
+
+    for(mode = 0; mode < 2 && !test.aborted; mode++) {
+        for(level = 0; level <= max_level; level++) {
+
+            uint32_t rate, isr_time = 0, latency = 0;
+
+            rate = steptest_run(level, mode == 1, &isr_time, &latency);
+
+            if(test.aborted)
+                break;
+
+            hal.stream.write("[STEPTEST:");
+            hal.stream.write(mode == 1 ? "MASKED" : pulse_mode);
+            hal.stream.write(",");
+            hal.stream.write(uitoa(level));
+            hal.stream.write(",");
+            hal.stream.write(uitoa(rate));
+            hal.stream.write(",");
+            hal.stream.write(uitoa(isr_time * 125 / 2)); // 16 MHz ticks to ns
+            hal.stream.write(",");
+            hal.stream.write(uitoa(latency * 125 / 2));
+            hal.stream.write("]" ASCII_EOL);
+        }
+    }
+
+    hal.stepper.interrupt_callback = interrupt_callback;
+
+    // Motors were disabled and direction outputs toggled behind the core's back
+    sys.homed.mask = 0;
+    st_reset();
+
+    return test.aborted ? Status_Reset : Status_OK;
+}
+
+void steptest_init (void)
+{
+    static const sys_command_t steptest_command_list[] = {
+        {"STEPTEST", steptest_command, {0}, { .str = "measure max sustainable step rate per AMASS level, motor drivers are disabled" } }
+    };
+
+    static sys_commands_t steptest_commands = {
+        .n_commands = sizeof(steptest_command_list) / sizeof(sys_command_t),
+        .commands = steptest_command_list
+    };
+
+    system_register_commands(&steptest_commands);
+}
+
+#endif // STEPTEST_ENABLE
@@ -0,0 +1,200 @@
+/*
+
+  telemetry.c - binary telemetry records framed in-band in the output stream
+
+  Machine position and input states are sampled at a fixed rate from the SysTick interrupt,
+  records are completed, framed and written to the output stream from the foreground.
+  The frame start character routes frames to the priority output lane, frames are terminated
+  by LF and do not contain NUL characters so they can be written as strings.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if TELEMETRY_ENABLE
+
+#include <string.h>
+
+#include "telemetry.h"
+
+#include "grbl/planner.h"
+#include "grbl/stepper.h"
+#include "grbl/state_machine.h"
+#include "grbl/nuts_bolts.h"
+
+#ifndef TELEMETRY_RATE
+#define TELEMETRY_RATE      0   // Hz, rate at startup, 0 for off. NOTE: UART bandwidth limits the rate to about 200 Hz at 115200 baud.
+#endif
+#define TELEMETRY_RATE_MAX  250
+
+typedef struct {
+    uint16_t sequence;
+    uint32_t timestamp;
+    int32_t position[N_AXIS];
+    limit_signals_t limits;
+    control_signals_t control;
+    probe_state_t probe;
+} telemetry_sample_t;
+
+static struct {
+    volatile uint16_t period;   // ms, 0 if disabled
+    uint16_t ticks;
+    uint16_t sequence;
+    uint32_t timestamp;
+    uint32_t frames;
+    uint32_t dropped;
+    volatile bool pending;
+    telemetry_sample_t sample;
+} tlm = {
+    .period = TELEMETRY_RATE ? 1000 / TELEMETRY_RATE : 0,
+    .ticks = TELEMETRY_RATE ? 1000 / TELEMETRY_RATE : 0
+};
+
+static on_execute_realtime_ptr on_execute_realtime;
+
+// Called every ms from the SysTick interrupt
+void telemetry_poll (void)
+{
+    tlm.timestamp++;
+
+    if(tlm.period == 0 || --tlm.ticks)
+        return;
+
+    tlm.ticks = tlm.period;
+    tlm.sequence++;
+
+    if(tlm.pending) {   // Previous sample not yet sent
+        tlm.dropped++;
+        return;
+    }
+
+    tlm.sample.sequence = tlm.sequence;
+    tlm.sample.timestamp = tlm.timestamp;
+    memcpy(tlm.sample.position, (void *)sys.position, sizeof(tlm.sample.position));
+    tlm.sample.limits = hal.limits.get_state();
+    tlm.sample.control = hal.control.get_state();
+    tlm.sample.probe = hal.probe.get_state ? hal.probe.get_state() : (probe_state_t){0};
+    tlm.pending = true;
+}
+
+static inline char *frame_add (char *s, uint8_t c)
+{
+    if(c == 0 || c == ASCII_LF || c == ASCII_CR || c == TELEMETRY_ESC) {
+        *s++ = TELEMETRY_ESC;
+        c ^= 0x20;
+    }
+    *s++ = c;
+
+    return s;
+}
+
+static void telemetry_send (void)
+{
+    static char frame[2 + (sizeof(telemetry_record_t) + 1) * 2 + 1];
+
+    uint_fast8_t idx;
+    uint8_t sum = 0, *data;
+    char *s = frame;
+    telemetry_record_t record;
+    sys_state_t state = state_get();
+
+    record.version = TELEMETRY_VERSION;
+    record.state = state == STATE_IDLE ? 0 : __builtin_ctz(state) + 1;
+    record.sequence = tlm.sample.sequence;
+    record.timestamp = tlm.sample.timestamp;
+    for(idx = 0; idx < N_AXIS; idx++)
+        record.position[idx] = (float)tlm.sample.position[idx] / settings.axis[idx].steps_per_mm;
+    record.feed_rate = st_get_realtime_rate();
+    record.spindle_rpm = sys.spindle_rpm;
+    record.limits = (uint8_t)tlm.sample.limits.min.mask;
+    record.probe = (tlm.sample.probe.triggered ? 0x01 : 0) | (tlm.sample.probe.connected ? 0x02 : 0);
+    record.control = (uint16_t)tlm.sample.control.value;
+    record.planner_free = (uint8_t)plan_get_block_buffer_available();
+    record.reserved = 0;
+    record.rx_free = hal.stream.get_rx_buffer_free();
+
+    tlm.pending = false;
+
+    *s++ = TELEMETRY_SOF;
+    data = (uint8_t *)&record;
+    for(idx = 0; idx < sizeof(telemetry_record_t); idx++) {
+        sum += data[idx];
+        s = frame_add(s, data[idx]);
+    }
+    s = frame_add(s, (uint8_t)-sum);
+    *s++ = ASCII_LF;
+    *s = '\0';
+
+    hal.stream.write(frame);
+    tlm.frames++;
+}
+
+static void telemetry_execute_realtime (uint_fast16_t state)
+{
+    on_execute_realtime(state);
+
+    if(tlm.pending)
+        telemetry_send();
+}
+
+static status_code_t telemetry_command (sys_state_t state, char *args)
+{
+    if(args) {
+        uint32_t rate;
+        uint_fast8_t cc = 0;
+        float value;
+
+        if(!read_float(args, &cc, &value) || args[cc] != '\0' || value < 0.0f || value > (float)TELEMETRY_RATE_MAX)
+            return Status_InvalidStatement;
+
+        rate = (uint32_t)value;
+        tlm.pending = false;
+        tlm.ticks = tlm.period = rate ? 1000 / rate : 0;
+    } else {
+        hal.stream.write("[TLM:");
+        hal.stream.write(uitoa(tlm.period ? 1000 / tlm.period : 0));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(tlm.frames));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(tlm.dropped));
+        hal.stream.write("]" ASCII_EOL);
+    }
+
+    return Status_OK;
+}
+
+void telemetry_init (void)
+{
+    static const sys_command_t telemetry_command_list[] = {
+        {"TLM", telemetry_command, {0}, { .str = "set binary telemetry rate in Hz, 0 to disable" } }
+    };
+
+    static sys_commands_t telemetry_commands = {
+        .n_commands = sizeof(telemetry_command_list) / sizeof(sys_command_t),
+        .commands = telemetry_command_list
+    };
+
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = telemetry_execute_realtime;
+
+    system_register_commands(&telemetry_commands);
+}
+
+#endif // TELEMETRY_ENABLE
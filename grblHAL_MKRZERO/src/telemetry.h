@@ -0,0 +1,56 @@
+/*
+
+  telemetry.h - binary telemetry records framed in-band in the output stream
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+
+#include "grbl/hal.h"
+
+#define TELEMETRY_SOF     0x02 // STX, frame start
+#define TELEMETRY_ESC     0x1B // Escapes 0x00, LF, CR and ESC in frame content, next byte is XORed with 0x20
+#define TELEMETRY_VERSION 1
+
+// Frame: SOF, escaped record, escaped checksum (two's complement of the 8-bit sum of the record bytes), LF.
+// All fields are little endian.
+typedef struct __attribute__((packed)) {
+    uint8_t version;            // TELEMETRY_VERSION
+    uint8_t state;              // 0 for Idle, else sys_state_t bit number + 1
+    uint16_t sequence;          // increments for each sample, gaps indicate dropped frames
+    uint32_t timestamp;         // ms
+    float position[N_AXIS];     // machine position, mm
+    float feed_rate;            // actual feed rate, mm/min
+    float spindle_rpm;
+    uint8_t limits;             // limit switch states, bit per axis
+    uint8_t probe;              // bit 0 triggered, bit 1 connected
+    uint16_t control;           // control signal states
+    uint8_t planner_free;       // free planner blocks
+    uint8_t reserved;
+    uint16_t rx_free;           // free bytes in input buffer
+} telemetry_record_t;
+
+void telemetry_init (void);
+void telemetry_poll (void);
+
+#endif
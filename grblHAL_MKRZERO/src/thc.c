@@ -0,0 +1,318 @@
+/*
+
+  thc.c - plasma torch height control from arc voltage
+
+  The arc voltage is read from an analog input, sampled by DMA with 16x hardware averaging.
+  The control law is run from the 1 ms SysTick interrupt every THC_PERIOD ms and computes the number of
+  Z steps to output in the next period, proportional to the voltage error and limited by the max
+  correction rate. The steps are injected by the pulse start handler while the block being executed
+  has no Z motion, spaced according to the max correction rate.
+  Corrections are held while the arc is not established, during the arc settle delay and when the
+  actual feed rate drops below the anti-dive threshold, e.g. when slowing down for corners.
+  The accumulated correction is added to the machine position when motion ends.
+
+  The correction is limited to THC_MAX_OFFSET mm and, when soft limits are enabled, to the work envelope.
+  Corrections are held when the limit is reached, e.g. on a lost or shorted arc voltage signal.
+
+  Use $THC=1 to enable, $THC=0 to disable. $THC reports enabled, active, arc voltage, Z offset (mm) and
+  limited.
+
+  Settings:
+    $456: arc voltage setpoint, V.
+    $457: gain, Z correction rate in mm/min per V of error.
+    $458: max Z correction rate, mm/min.
+    $459: anti-dive threshold, percent of programmed feed rate scaled by the feed override.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if THC_ENABLE
+
+#include <math.h>
+
+#include "thc.h"
+#include "analog.h"
+
+#include "grbl/gcode.h"
+#include "grbl/planner.h"
+#include "grbl/stepper.h"
+#include "grbl/state_machine.h"
+#include "grbl/nvs_buffer.h"
+#include "grbl/nuts_bolts.h"
+
+#ifndef THC_CHANNEL
+#define THC_CHANNEL             0       // Analog input for arc voltage
+#endif
+#ifndef THC_PERIOD
+#define THC_PERIOD              10      // ms
+#endif
+#ifndef THC_FULL_SCALE_VOLTAGE
+#define THC_FULL_SCALE_VOLTAGE  300.0f  // Arc voltage at full scale ADC input, depends on the voltage divider
+#endif
+#ifndef THC_ARC_OK_VOLTAGE
+#define THC_ARC_OK_VOLTAGE      50.0f   // Arc is considered established above this voltage
+#endif
+#ifndef THC_DEADBAND
+#define THC_DEADBAND            1.0f    // V
+#endif
+#ifndef THC_ARC_DELAY
+#define THC_ARC_DELAY           500     // Arc settle delay, ms
+#endif
+#ifndef THC_MAX_OFFSET
+#define THC_MAX_OFFSET          10.0f   // Max correction from the programmed height, mm
+#endif
+
+typedef struct {
+    float setpoint;
+    float gain;
+    float max_rate;
+    uint8_t antidive;
+} thc_settings_t;
+
+static thc_settings_t thc_settings;
+static nvs_address_t nvs_address;
+static on_state_change_ptr on_state_change;
+static on_reset_ptr on_reset;
+
+static struct {
+    volatile bool enabled;
+    bool active;
+    bool dir_owned;             // Z direction output changed from the block direction
+    bool limited;               // correction held at the max offset or a soft limit
+    uint16_t ticks;
+    uint16_t arc_ticks;         // ms since arc established
+    float voltage;
+    float steps;                // fractional Z steps carried over to the next period
+    uint32_t min_cycles;        // min stepper timer cycles between injected steps
+    uint32_t cycles;            // stepper timer cycles since last injected step
+    volatile int32_t pending;   // steps to inject, negative for down
+    volatile int32_t offset;    // steps injected since motion started
+} thc = {
+    .ticks = THC_PERIOD
+};
+
+// Called from the driver pulse start functions before the step and direction outputs are set.
+// A direction change is output one tick ahead of the step to ensure setup time.
+// The core only updates the direction outputs when the direction bits of consecutive blocks differ,
+// so the Z direction is restored from the block when injection ends or a block with Z motion starts.
+void thc_pulse_start (stepper_t *stepper)
+{
+    if(stepper->exec_block == NULL)
+        return;
+
+    int32_t pending = thc.pending;
+
+    if(thc.dir_owned && (pending == 0 || stepper->exec_block->steps[Z_AXIS])) {
+        thc.dir_owned = false;
+        if(stepper->dir_outbits.z != stepper->exec_block->direction_bits.z) {
+            stepper->dir_outbits.z = stepper->exec_block->direction_bits.z;
+            stepper->dir_change = On;
+        }
+    }
+
+    if(pending == 0 || stepper->exec_block->steps[Z_AXIS])
+        return;
+
+    if((thc.cycles += STEPPER_TIMER->COUNT32.CC[0].reg) < thc.min_cycles || stepper->dir_change)
+        return;
+
+    bool down = pending < 0;
+
+    if(stepper->dir_outbits.z != down) {
+        stepper->dir_outbits.z = down;
+        stepper->dir_change = On;
+        thc.dir_owned = true;
+        thc.cycles = 0;
+    } else {
+        stepper->step_outbits.z = On;
+        thc.pending = down ? pending + 1 : pending - 1;
+        thc.offset += down ? -1 : 1;
+        thc.cycles = 0;
+    }
+}
+
+// Called every ms from the SysTick interrupt
+void thc_poll (void)
+{
+    if(--thc.ticks)
+        return;
+
+    thc.ticks = THC_PERIOD;
+    thc.voltage = (float)analog_read(THC_CHANNEL) * THC_FULL_SCALE_VOLTAGE / (float)ANALOG_MAX_VALUE;
+
+    if(thc.voltage < THC_ARC_OK_VOLTAGE)
+        thc.arc_ticks = 0;
+    else if(thc.arc_ticks < THC_ARC_DELAY)
+        thc.arc_ticks += THC_PERIOD;
+
+    plan_block_t *block;
+
+    thc.active = thc.enabled && thc.arc_ticks >= THC_ARC_DELAY && state_get() == STATE_CYCLE &&
+                  (block = plan_get_current_block()) && block->steps[Z_AXIS] == 0 &&
+                   st_get_realtime_rate() >= block->programmed_rate * (float)sys.override.feed_rate * (float)thc_settings.antidive / 10000.0f;
+
+    float error = thc_settings.setpoint - thc.voltage; // Low voltage: torch too close, move up
+
+    if(!thc.active || fabsf(error) <= THC_DEADBAND) {
+        thc.pending = 0;
+        thc.steps = 0.0f;
+        return;
+    }
+
+    float rate = error * thc_settings.gain, steps_per_mm = settings.axis[Z_AXIS].steps_per_mm;
+
+    if(rate > thc_settings.max_rate)
+        rate = thc_settings.max_rate;
+    else if(rate < -thc_settings.max_rate)
+        rate = -thc_settings.max_rate;
+
+    thc.steps += rate * steps_per_mm * (float)THC_PERIOD / 60000.0f;
+
+    int32_t delta = (int32_t)thc.steps, offset = thc.offset + delta,
+            max = (int32_t)(THC_MAX_OFFSET * steps_per_mm), min = -max;
+
+    thc.steps -= (float)delta;
+
+    // Position of the torch is the core position plus the offset
+    if(settings.limits.flags.soft_enabled) {
+        int32_t envelope = (int32_t)(sys.work_envelope.max[Z_AXIS] * steps_per_mm) - sys.position[Z_AXIS];
+        if(envelope < max)
+            max = envelope;
+        envelope = (int32_t)(sys.work_envelope.min[Z_AXIS] * steps_per_mm) - sys.position[Z_AXIS];
+        if(envelope > min)
+            min = envelope;
+    }
+
+    if((thc.limited = offset > max || offset < min)) {
+        offset = offset > max ? max : min;
+        thc.steps = 0.0f;
+    }
+
+    thc.pending = offset - thc.offset;
+    thc.min_cycles = (uint32_t)((float)hal.f_step_timer * 60.0f / (thc_settings.max_rate * steps_per_mm));
+}
+
+// Adds the accumulated correction to the machine position when motion has ended
+static void thc_state_change (sys_state_t state)
+{
+    if(state == STATE_IDLE && thc.offset) {
+        thc.pending = 0;
+        sys.position[Z_AXIS] += thc.offset;
+        thc.offset = 0;
+        plan_sync_position();
+        gc_sync_position();
+    }
+
+    if(on_state_change)
+        on_state_change(state);
+}
+
+// Discards the correction on reset, the position is either lost or resynced by the core
+static void thc_reset (void)
+{
+    thc.pending = 0;
+    thc.offset = 0;
+    thc.steps = 0.0f;
+
+    if(on_reset)
+        on_reset();
+}
+
+static status_code_t thc_command (sys_state_t state, char *args)
+{
+    if(args) {
+        if(!(*args == '0' || *args == '1') || args[1] != '\0')
+            return Status_InvalidStatement;
+        thc.enabled = *args == '1';
+    } else {
+        hal.stream.write("[THC:");
+        hal.stream.write(thc.enabled ? "1," : "0,");
+        hal.stream.write(thc.active ? "1," : "0,");
+        hal.stream.write(ftoa(thc.voltage, 1));
+        hal.stream.write(",");
+        hal.stream.write(ftoa((float)thc.offset / settings.axis[Z_AXIS].steps_per_mm, N_DECIMAL_COORDVALUE_MM));
+        hal.stream.write(thc.limited ? ",1" : ",0");
+        hal.stream.write("]" ASCII_EOL);
+    }
+
+    return Status_OK;
+}
+
+static const setting_detail_t thc_setting_details[] = {
+    { Setting_UserDefined_6, Group_General, "THC arc voltage setpoint", "V", Format_Decimal, "##0.0", "0", "300", Setting_NonCore, &thc_settings.setpoint, NULL, NULL },
+    { Setting_UserDefined_7, Group_General, "THC gain", "mm/min/V", Format_Decimal, "###0.0", "0", "1000", Setting_NonCore, &thc_settings.gain, NULL, NULL },
+    { Setting_UserDefined_8, Group_General, "THC max correction rate", "mm/min", Format_Decimal, "###0.0", "1", "5000", Setting_NonCore, &thc_settings.max_rate, NULL, NULL },
+    { Setting_UserDefined_9, Group_General, "THC anti-dive threshold", "percent", Format_Int8, "##0", "0", "100", Setting_NonCore, &thc_settings.antidive, NULL, NULL }
+};
+
+static void thc_settings_save (void)
+{
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&thc_settings, sizeof(thc_settings_t), true);
+}
+
+static void thc_settings_restore (void)
+{
+    thc_settings.setpoint = 120.0f;
+    thc_settings.gain = 50.0f;
+    thc_settings.max_rate = 500.0f;
+    thc_settings.antidive = 90;
+
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&thc_settings, sizeof(thc_settings_t), true);
+}
+
+static void thc_settings_load (void)
+{
+    if(hal.nvs.memcpy_from_nvs((uint8_t *)&thc_settings, nvs_address, sizeof(thc_settings_t), true) != NVS_TransferResult_OK)
+        thc_settings_restore();
+}
+
+void thc_init (void)
+{
+    static const sys_command_t thc_command_list[] = {
+        {"THC", thc_command, {0}, { .str = "enable (1) or disable (0) torch height control" } }
+    };
+
+    static sys_commands_t thc_commands = {
+        .n_commands = sizeof(thc_command_list) / sizeof(sys_command_t),
+        .commands = thc_command_list
+    };
+
+    static setting_details_t setting_details = {
+        .settings = thc_setting_details,
+        .n_settings = sizeof(thc_setting_details) / sizeof(setting_detail_t),
+        .save = thc_settings_save,
+        .load = thc_settings_load,
+        .restore = thc_settings_restore
+    };
+
+    if((nvs_address = nvs_alloc(sizeof(thc_settings_t))))
+        settings_register(&setting_details);
+
+    on_state_change = grbl.on_state_change;
+    grbl.on_state_change = thc_state_change;
+
+    on_reset = grbl.on_reset;
+    grbl.on_reset = thc_reset;
+
+    system_register_commands(&thc_commands);
+}
+
+#endif // THC_ENABLE
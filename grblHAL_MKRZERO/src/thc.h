@@ -0,0 +1,33 @@
+/*
+
+  thc.h - plasma torch height control from arc voltage
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _THC_H_
+#define _THC_H_
+
+#include "grbl/hal.h"
+
+void thc_init (void);
+void thc_poll (void);
+void thc_pulse_start (stepper_t *stepper);
+
+#endif
@@ -0,0 +1,339 @@
+/*
+
+  tokjob.c - pre-tokenised G-code job format, encoder and decoder
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifdef TOKJOB_HOST
+#define SDJOB_ENABLE 1
+#else
+#include "driver.h"
+#endif
+
+#if SDJOB_ENABLE
+
+#include <string.h>
+
+#include "tokjob.h"
+
+static const uint8_t magic[4] = { 'G', 'T', 'O', 'K' };
+
+void tokjob_write_header (uint8_t *header)
+{
+    memset(header, 0, TOKJOB_HEADER_SIZE);
+    memcpy(header, magic, sizeof(magic));
+    header[4] = TOKJOB_VERSION;
+}
+
+bool tokjob_check_header (const uint8_t *header)
+{
+    return memcmp(header, magic, sizeof(magic)) == 0 && header[4] == TOKJOB_VERSION;
+}
+
+static inline bool is_letter (char c)
+{
+    return c >= 'A' && c <= 'Z';
+}
+
+static inline bool is_digit (char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Parses a number, returns the number of characters consumed or 0 if not a valid number.
+// The value is returned scaled by 10^decimals with trailing zero decimals removed.
+static int parse_value (const char *s, int32_t *value, uint_fast8_t *decimals)
+{
+    const char *start = s;
+    bool negative = false, fraction = false, digits = false;
+    uint_fast8_t n_decimals = 0;
+    int64_t v = 0;
+    int rounding = 0;
+
+    if(*s == '-' || *s == '+')
+        negative = *s++ == '-';
+
+    while(is_digit(*s) || (*s == '.' && !fraction)) {
+        if(*s == '.')
+            fraction = true;
+        else {
+            digits = true;
+            if(!fraction || n_decimals < TOKJOB_MAX_DECIMALS) {
+                v = v * 10 + (*s - '0');
+                if(fraction)
+                    n_decimals++;
+            } else if(rounding == 0)
+                rounding = *s >= '5' ? 1 : -1;
+            if(v > INT32_MAX)
+                return 0;
+        }
+        s++;
+    }
+
+    if(!digits)
+        return 0;
+
+    if(rounding > 0)
+        v++;
+
+    while(n_decimals && v % 10 == 0) {
+        v /= 10;
+        n_decimals--;
+    }
+
+    if(v > INT32_MAX)
+        return 0;
+
+    *value = negative ? -(int32_t)v : (int32_t)v;
+    *decimals = n_decimals;
+
+    return s - start;
+}
+
+static uint8_t *put_varint (uint8_t *out, uint8_t *end, int32_t value)
+{
+    uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); // zigzag
+
+    do {
+        if(out == end)
+            return NULL;
+        *out++ = (v > 0x7F ? 0x80 : 0) | (v & 0x7F);
+        v >>= 7;
+    } while(v);
+
+    return out;
+}
+
+static const uint32_t pow10[] = { 1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1 };
+
+// Writes the value as text scaled by 10^-decimals, returns pointer to the end or NULL if it does not fit before end.
+// Digits are found by repeated subtraction of powers of ten as the Cortex-M0+ has no hardware divider.
+static char *put_value (char *s, const char *end, int32_t value, uint_fast8_t decimals)
+{
+    char digit;
+    uint_fast8_t idx = 0, last = sizeof(pow10) / sizeof(uint32_t) - 1;
+    uint32_t v = value < 0 ? -(uint32_t)value : (uint32_t)value;
+
+    // Skip leading zeroes, keep one before the decimal point
+    while(idx < last && pow10[idx] > v && last - idx > decimals)
+        idx++;
+
+    if(s + (value < 0 ? 1 : 0) + (last - idx + 1) + (decimals ? 1 : 0) > end)
+        return NULL;
+
+    if(value < 0)
+        *s++ = '-';
+
+    for(; idx <= last; idx++) {
+        if(last - idx + 1 == decimals)
+            *s++ = '.';
+        digit = '0';
+        while(v >= pow10[idx]) {
+            v -= pow10[idx];
+            digit++;
+        }
+        *s++ = digit;
+    }
+
+    return s;
+}
+
+// Stores the line verbatim except for comments, message comments are kept
+static int encode_text (const char *line, size_t length, uint8_t *out, size_t size)
+{
+    const char *s = line, *end = line + length, *comment;
+    uint8_t *text = &out[2];
+    size_t n = 0;
+    bool message = false;
+
+    while(s < end && (message || *s != ';')) {
+        if(message)
+            message = *s != ')';
+        else if(*s == '(') {
+            if(!(message = !strncmp(s + 1, "MSG,", 4) || !strncmp(s + 1, "PRINT,", 6) || !strncmp(s + 1, "DEBUG,", 6))) {
+                if((comment = memchr(s, ')', end - s)) == NULL)
+                    break;
+                s = comment + 1;
+                continue;
+            }
+        }
+        if(n == TOKJOB_MAX_LINE || n + 3 >= size)
+            return -1;
+        text[n++] = (uint8_t)*s++;
+    }
+
+    if(n == 0)
+        return 0;
+
+    out[0] = TOKJOB_TEXT;
+    out[1] = (uint8_t)n;
+    out[n + 2] = TOKJOB_EOB;
+
+    return n + 3;
+}
+
+// Encodes a line of G-code, returns number of bytes written to out, 0 if nothing to encode or -1 on error.
+// Lines that cannot be tokenised (expressions, parameters, system commands, messages etc.) are stored as text.
+int tokjob_encode_line (const char *line, uint8_t *out, size_t size)
+{
+    char c;
+    const char *s;
+    int32_t value;
+    uint_fast8_t decimals;
+    size_t length = strlen(line), decoded = 0;
+    uint8_t *p = out, *end = out + size;
+    bool comment = false;
+    char scratch[16];
+
+    while(length && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        length--;
+
+    // Lines with anything but words, comments and whitespace are kept as is
+    for(s = line; s < line + length; s++) {
+        c = *s;
+        if(comment)
+            comment = c != ')';
+        else if(c == '(') {
+            if(!strncmp(s + 1, "MSG,", 4) || !strncmp(s + 1, "PRINT,", 6) || !strncmp(s + 1, "DEBUG,", 6))
+                return encode_text(line, length, out, size);
+            comment = true;
+        } else if(c == ';')
+            break;
+        else if(!(c == ' ' || c == '\t' || c == '.' || c == '-' || c == '+' || is_digit(c) || is_letter(c & ~0x20)) || (c & ~0x20) == 'O')
+            return encode_text(line, length, out, size);
+    }
+
+    for(s = line; s < line + length;) {
+
+        c = *s;
+
+        if(c == '(') {
+            while(s < line + length && *s != ')')
+                s++;
+            s++;
+            continue;
+        }
+
+        if(c == ';')
+            break;
+
+        if(c == ' ' || c == '\t') {
+            s++;
+            continue;
+        }
+
+        c &= ~0x20;
+        if(!is_letter(c))
+            return encode_text(line, length, out, size);
+
+        int consumed = parse_value(++s, &value, &decimals);
+
+        if(consumed == 0)
+            return encode_text(line, length, out, size);
+
+        s += consumed;
+        decoded += 1 + (put_value(scratch, scratch + sizeof(scratch), value, decimals) - scratch);
+
+        if(p == end)
+            return -1;
+
+        *p++ = (decimals << 5) | (c - 'A' + 1);
+        if((p = put_varint(p, end, value)) == NULL)
+            return -1;
+    }
+
+    if(p == out)
+        return 0;
+
+    if(decoded > TOKJOB_MAX_LINE || p == end)
+        return -1;
+
+    *p++ = TOKJOB_EOB;
+
+    return p - out;
+}
+
+static int get_varint (tokjob_getc_ptr getc, void *context, int32_t *value)
+{
+    int c;
+    uint_fast8_t shift = 0;
+    uint32_t v = 0;
+
+    do {
+        if((c = getc(context)) < 0 || shift > 28)
+            return TOKJOB_ERROR;
+        v |= (uint32_t)(c & 0x7F) << shift;
+        shift += 7;
+    } while(c & 0x80);
+
+    *value = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+
+    return 0;
+}
+
+// Decodes the next block into line, returns the line length, TOKJOB_END at end of job or TOKJOB_ERROR.
+// size must be at least TOKJOB_MAX_LINE + 1, the line is terminated.
+int tokjob_decode_block (tokjob_getc_ptr getc, void *context, char *line, size_t size)
+{
+    int c, length;
+    int32_t value;
+    char *s = line;
+
+    if(size <= TOKJOB_MAX_LINE)
+        return TOKJOB_ERROR;
+
+    while(true) {
+
+        if((c = getc(context)) < 0)
+            return TOKJOB_ERROR;
+
+        switch(c & 0x1F) {
+
+            case TOKJOB_EOB:
+                *s = '\0';
+                return s - line;
+
+            case TOKJOB_EOF:
+                return s == line ? TOKJOB_END : TOKJOB_ERROR;
+
+            case TOKJOB_TEXT:
+                if(s != line || (length = getc(context)) < 0 || length > TOKJOB_MAX_LINE)
+                    return TOKJOB_ERROR;
+                while(length--) {
+                    if((c = getc(context)) < 0)
+                        return TOKJOB_ERROR;
+                    *s++ = (char)c;
+                }
+                break;
+
+            default:
+                if((c & 0x1F) > 26 || (c >> 5) > TOKJOB_MAX_DECIMALS || get_varint(getc, context, &value) != 0)
+                    return TOKJOB_ERROR;
+                if(s == line + TOKJOB_MAX_LINE)
+                    return TOKJOB_ERROR;
+                *s++ = 'A' - 1 + (c & 0x1F);
+                if((s = put_value(s, line + TOKJOB_MAX_LINE, value, c >> 5)) == NULL)
+                    return TOKJOB_ERROR;
+                break;
+        }
+    }
+}
+
+#endif // SDJOB_ENABLE
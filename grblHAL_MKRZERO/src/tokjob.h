@@ -0,0 +1,69 @@
+/*
+
+  tokjob.h - pre-tokenised G-code job format
+
+  Jobs are converted offline by tools/gcode2tok.c. Comments and whitespace are removed and each
+  word is stored as a token byte followed by a variable length integer. Blocks are decoded back
+  to compact canonical lines for the parser, a job has to be terminated by TOKJOB_EOF.
+  This file and tokjob.c are plain C without dependencies so they can be built on the host.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _TOKJOB_H_
+#define _TOKJOB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef TOKJOB_HOST
+#ifndef LINE_BUFFER_SIZE
+#define LINE_BUFFER_SIZE 257 // grbl/config.h default, build with -DLINE_BUFFER_SIZE=<n> if changed for the controller
+#endif
+#else
+#include "grbl/config.h"
+#endif
+
+#define TOKJOB_VERSION      1
+#define TOKJOB_HEADER_SIZE  8   // "GTOK", version, 3 reserved bytes
+#if LINE_BUFFER_SIZE > 256
+#define TOKJOB_MAX_LINE     255 // max length of a decoded block, excluding terminator, limited by the text length byte
+#else
+#define TOKJOB_MAX_LINE     (LINE_BUFFER_SIZE - 1) // max length of a decoded block, excluding terminator
+#endif
+#define TOKJOB_MAX_DECIMALS 6
+
+// Token byte: bits 7-5 number of decimals, bits 4-0 code.
+#define TOKJOB_EOB          0   // End of block
+                                // 1 - 26: word letter A - Z, followed by the value * 10^decimals, zigzag LEB128 encoded
+#define TOKJOB_TEXT         27  // Block stored verbatim, followed by a length byte and the text
+#define TOKJOB_EOF          28  // End of job
+
+#define TOKJOB_END          -1  // tokjob_decode_block() return values
+#define TOKJOB_ERROR        -2  // invalid data or end of data before TOKJOB_EOF
+
+typedef int (*tokjob_getc_ptr)(void *context); // returns next byte or -1 at end of data
+
+void tokjob_write_header (uint8_t *header);
+bool tokjob_check_header (const uint8_t *header);
+int tokjob_encode_line (const char *line, uint8_t *out, size_t size);
+int tokjob_decode_block (tokjob_getc_ptr getc, void *context, char *line, size_t size);
+
+#endif
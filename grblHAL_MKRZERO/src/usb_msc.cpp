@@ -0,0 +1,536 @@
+/*
+
+  usb_msc.cpp - USB mass storage (bulk only transport, SCSI) exposing the SD card
+
+  The interface is always enumerated together with the CDC serial port, the medium is reported
+  as not present until it is exposed with $MSC=1. This is only allowed when idle and no SD card
+  job is running. FatFs access to the card is blocked while exposed and SD card jobs are refused,
+  the card is handed back with $MSC=0, by ejecting the drive on the host or when the controller
+  leaves the idle state, whatever the stream. A transfer in progress is then completed without
+  further card access and the medium reported as not present.
+  Commands and data are handled from the foreground, reads and writes are done in chunks of
+  MSC_BUFFER_BLOCKS sectors with multi-block disk transfers. Reads are polled, only writes use DMA.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <string.h>
+
+#include "driver.h"
+
+#if USB_MSC_ENABLE
+
+#include "Arduino.h"
+#include "USB/PluggableUSB.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+#include "grbl/nuts_bolts.h"
+
+#include "diskio.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "usb_msc.h"
+
+#ifndef MSC_BUFFER_BLOCKS
+#define MSC_BUFFER_BLOCKS 4
+#endif
+
+#define MSC_CBW_SIGNATURE 0x43425355 // USBC
+#define MSC_CSW_SIGNATURE 0x53425355 // USBS
+
+#define MSC_REQUEST_RESET       0xFF
+#define MSC_REQUEST_GET_MAX_LUN 0xFE
+
+// SCSI sense keys
+#define SENSE_NONE              0x00
+#define SENSE_NOT_READY         0x02
+#define SENSE_MEDIUM_ERROR      0x03
+#define SENSE_ILLEGAL_REQUEST   0x05
+#define SENSE_UNIT_ATTENTION    0x06
+
+typedef struct __attribute__((packed)) {
+    uint32_t signature;
+    uint32_t tag;
+    uint32_t data_length;
+    uint8_t flags;          // bit 7 set for device to host
+    uint8_t lun;
+    uint8_t cb_length;
+    uint8_t cb[16];
+} msc_cbw_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t signature;
+    uint32_t tag;
+    uint32_t residue;
+    uint8_t status;         // 0 passed, 1 failed
+} msc_csw_t;
+
+typedef enum {
+    MSC_Command = 0,
+    MSC_DataIn,
+    MSC_DataOut,
+    MSC_Status
+} msc_phase_t;
+
+static struct {
+    bool exposed;
+    bool attention;         // medium changed, reported once by the next command
+    volatile bool reset;    // bulk only mass storage reset requested
+    msc_phase_t phase;
+    uint_fast8_t cbw_length;
+    msc_cbw_t cbw;
+    msc_csw_t csw;
+    uint32_t block_count;   // card capacity
+    uint32_t lba;           // next sector of a READ/WRITE
+    uint32_t blocks;        // sectors remaining of a READ/WRITE
+    uint32_t length;        // bytes remaining of data phase
+    uint32_t valid;         // bytes of data phase transferred to or from the medium or a response
+    uint32_t count;         // bytes in buffer
+    uint8_t sense_key;
+    uint8_t asc;
+    uint8_t buffer[MSC_BUFFER_BLOCKS * 512] __attribute__((aligned(4)));
+} msc = {0};
+
+static on_execute_realtime_ptr on_execute_realtime;
+static on_state_change_ptr on_state_change;
+
+class USBMSC_ : public PluggableUSBModule {
+
+  public:
+    USBMSC_ (void) : PluggableUSBModule(2, 1, epType)
+    {
+        epType[0] = USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_OUT(0);
+        epType[1] = USB_ENDPOINT_TYPE_BULK | USB_ENDPOINT_IN(0);
+        PluggableUSB().plug(this);
+    }
+
+    uint32_t epOut (void) { return pluggedEndpoint; }
+    uint32_t epIn (void) { return pluggedEndpoint + 1; }
+
+  protected:
+    int getInterface (uint8_t *interfaceCount);
+    int getDescriptor (USBSetup &setup);
+    bool setup (USBSetup &setup);
+
+  private:
+    uint32_t epType[2];
+};
+
+typedef struct {
+    InterfaceDescriptor msc;
+    EndpointDescriptor out;
+    EndpointDescriptor in;
+} MSCDescriptor;
+
+int USBMSC_::getInterface (uint8_t *interfaceCount)
+{
+    *interfaceCount += 1;
+
+    MSCDescriptor descriptor = {
+        D_INTERFACE(pluggedInterface, 2, 0x08, 0x06, 0x50), // Mass storage, SCSI transparent, bulk only
+        D_ENDPOINT(USB_ENDPOINT_OUT(pluggedEndpoint), USB_ENDPOINT_TYPE_BULK, EPX_SIZE, 0),
+        D_ENDPOINT(USB_ENDPOINT_IN(pluggedEndpoint + 1), USB_ENDPOINT_TYPE_BULK, EPX_SIZE, 0)
+    };
+
+    return USBDevice.sendControl(&descriptor, sizeof(descriptor));
+}
+
+int USBMSC_::getDescriptor (USBSetup &setup)
+{
+    return 0;
+}
+
+// Called from the USB interrupt
+bool USBMSC_::setup (USBSetup &setup)
+{
+    if(setup.wIndex != pluggedInterface)
+        return false;
+
+    if(setup.bmRequestType == REQUEST_DEVICETOHOST_CLASS_INTERFACE && setup.bRequest == MSC_REQUEST_GET_MAX_LUN) {
+        uint8_t max_lun = 0;
+        USBDevice.sendControl(&max_lun, 1);
+        return true;
+    }
+
+    if(setup.bmRequestType == REQUEST_HOSTTODEVICE_CLASS_INTERFACE && setup.bRequest == MSC_REQUEST_RESET) {
+        msc.reset = true;
+        return true;
+    }
+
+    return false;
+}
+
+static USBMSC_ usb_msc;
+
+static inline uint32_t min32 (uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+static inline uint32_t get_be32 (const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void put_be32 (uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void set_sense (uint8_t key, uint8_t asc)
+{
+    msc.sense_key = key;
+    msc.asc = asc;
+    if(key != SENSE_NONE)
+        msc.csw.status = 1;
+}
+
+static bool medium_ready (void)
+{
+    if(!msc.exposed)
+        set_sense(SENSE_NOT_READY, 0x3A);       // Medium not present
+    else if(msc.attention) {
+        msc.attention = false;
+        set_sense(SENSE_UNIT_ATTENTION, 0x28);  // Medium may have changed
+    } else
+        return true;
+
+    return false;
+}
+
+static void release (void)
+{
+    if(msc.exposed) {
+        msc.exposed = false;
+        if(msc.blocks) {
+            // Abort the transfer in progress, the remaining data phase is padded or discarded
+            msc.blocks = 0;
+            set_sense(SENSE_NOT_READY, 0x3A); // Medium not present
+        }
+        disk_usb_claim(false);
+    }
+}
+
+static bool expose (void)
+{
+    if(!msc.exposed) {
+
+        disk_usb_claim(true);
+
+        if(disk_ioctl(0, GET_SECTOR_COUNT, &msc.block_count) != RES_OK) {
+            disk_usb_claim(false);
+            return false;
+        }
+
+        msc.exposed = msc.attention = true;
+    }
+
+    return true;
+}
+
+// Sets up data phase for a READ(10) or WRITE(10) command
+static bool setup_transfer (void)
+{
+    uint32_t lba = get_be32(&msc.cbw.cb[2]), blocks = (msc.cbw.cb[7] << 8) | msc.cbw.cb[8];
+
+    if(!medium_ready())
+        return false;
+
+    if(lba + blocks > msc.block_count) {
+        set_sense(SENSE_ILLEGAL_REQUEST, 0x21); // Logical block address out of range
+        return false;
+    }
+
+    msc.lba = lba;
+    msc.blocks = min32(blocks, msc.cbw.data_length / 512);
+
+    return true;
+}
+
+static void process_command (void)
+{
+    bool to_host = !!(msc.cbw.flags & 0x80);
+    uint8_t *response = msc.buffer;
+
+    msc.csw.signature = MSC_CSW_SIGNATURE;
+    msc.csw.tag = msc.cbw.tag;
+    msc.csw.status = 0;
+    msc.length = msc.cbw.data_length;
+    msc.valid = msc.count = msc.blocks = 0;
+
+    memset(response, 0, 36);
+
+    switch(msc.cbw.cb[0]) {
+
+        case 0x00: // TEST UNIT READY
+            medium_ready();
+            break;
+
+        case 0x03: // REQUEST SENSE
+            response[0] = 0x70;
+            response[2] = msc.sense_key;
+            response[7] = 10;
+            response[12] = msc.asc;
+            msc.count = 18;
+            msc.sense_key = msc.asc = 0;
+            break;
+
+        case 0x12: // INQUIRY
+            response[1] = 0x80; // Removable
+            response[2] = 0x02;
+            response[3] = 0x02;
+            response[4] = 31;
+            memcpy(&response[8], "grblHAL MKRZERO SD card 1.00", 28); // Vendor, product and revision
+            msc.count = 36;
+            break;
+
+        case 0x1A: // MODE SENSE(6)
+            response[0] = 3;
+            msc.count = 4;
+            break;
+
+        case 0x5A: // MODE SENSE(10)
+            response[1] = 6;
+            msc.count = 8;
+            break;
+
+        case 0x1B: // START STOP UNIT
+            if((msc.cbw.cb[4] & 0x03) == 0x02) // Eject
+                release();
+            break;
+
+        case 0x1E: // PREVENT ALLOW MEDIUM REMOVAL
+        case 0x2F: // VERIFY(10)
+            break;
+
+        case 0x23: // READ FORMAT CAPACITIES
+            if(medium_ready()) {
+                response[3] = 8;
+                put_be32(&response[4], msc.block_count);
+                put_be32(&response[8], 512);
+                response[8] = 0x02; // Formatted media
+                msc.count = 12;
+            }
+            break;
+
+        case 0x25: // READ CAPACITY(10)
+            if(medium_ready()) {
+                put_be32(&response[0], msc.block_count - 1);
+                put_be32(&response[4], 512);
+                msc.count = 8;
+            }
+            break;
+
+        case 0x28: // READ(10)
+            if(to_host)
+                setup_transfer();
+            break;
+
+        case 0x2A: // WRITE(10)
+            if(!to_host)
+                setup_transfer();
+            break;
+
+        case 0x35: // SYNCHRONIZE CACHE(10)
+            if(medium_ready() && disk_ioctl(0, CTRL_SYNC, NULL) != RES_OK)
+                set_sense(SENSE_MEDIUM_ERROR, 0x0C); // Write error
+            break;
+
+        default:
+            set_sense(SENSE_ILLEGAL_REQUEST, 0x20); // Invalid command operation code
+            break;
+    }
+
+    msc.phase = msc.length == 0 ? MSC_Status : (to_host ? MSC_DataIn : MSC_DataOut);
+}
+
+// Sends a chunk of response or sector data, pads with zeroes when the host expects more.
+static void data_in (void)
+{
+    uint32_t length;
+
+    if(msc.count == 0 && msc.blocks) {
+        uint32_t blocks = min32(msc.blocks, MSC_BUFFER_BLOCKS);
+        if(disk_read(0, msc.buffer, msc.lba, blocks) == RES_OK) {
+            msc.lba += blocks;
+            msc.blocks -= blocks;
+            msc.count = blocks * 512;
+        } else {
+            msc.blocks = 0;
+            set_sense(SENSE_MEDIUM_ERROR, 0x11); // Unrecovered read error
+        }
+    }
+
+    if(msc.count)
+        msc.valid += (length = min32(msc.length, msc.count));
+    else {
+        memset(msc.buffer, 0, sizeof(msc.buffer));
+        length = min32(msc.length, sizeof(msc.buffer));
+    }
+
+    USBDevice.send(usb_msc.epIn(), msc.buffer, length);
+
+    msc.count = 0;
+    if((msc.length -= length) == 0)
+        msc.phase = MSC_Status;
+}
+
+// Receives sector data and writes complete chunks, data not belonging to a WRITE is discarded.
+static void data_out (void)
+{
+    uint32_t target, length;
+
+    if(!USBDevice.available(usb_msc.epOut()))
+        return;
+
+    target = msc.blocks ? min32(msc.blocks, MSC_BUFFER_BLOCKS) * 512 : min32(msc.length, sizeof(msc.buffer));
+    length = USBDevice.recv(usb_msc.epOut(), msc.buffer + msc.count, min32(target - msc.count, msc.length));
+
+    msc.count += length;
+    msc.length -= length;
+
+    if(msc.count == target || msc.length == 0) {
+        if(msc.blocks && msc.count == target) {
+            uint32_t blocks = target / 512;
+            if(disk_write(0, msc.buffer, msc.lba, blocks) == RES_OK) {
+                msc.lba += blocks;
+                msc.blocks -= blocks;
+                msc.valid += target;
+            } else {
+                msc.blocks = 0;
+                set_sense(SENSE_MEDIUM_ERROR, 0x0C); // Write error
+            }
+        }
+        msc.count = 0;
+    }
+
+    if(msc.length == 0)
+        msc.phase = MSC_Status;
+}
+
+static void msc_execute_realtime (uint_fast16_t state)
+{
+    on_execute_realtime(state);
+
+    if(msc.reset) {
+        msc.reset = false;
+        msc.phase = MSC_Command;
+        msc.cbw_length = 0;
+    }
+
+    switch(msc.phase) {
+
+        case MSC_Command:
+            if(USBDevice.available(usb_msc.epOut())) {
+                msc.cbw_length += USBDevice.recv(usb_msc.epOut(), (uint8_t *)&msc.cbw + msc.cbw_length, sizeof(msc_cbw_t) - msc.cbw_length);
+                if(msc.cbw_length == sizeof(msc_cbw_t)) {
+                    msc.cbw_length = 0;
+                    if(msc.cbw.signature == MSC_CBW_SIGNATURE && msc.cbw.lun == 0)
+                        process_command();
+                }
+            }
+            break;
+
+        case MSC_DataIn:
+            data_in();
+            break;
+
+        case MSC_DataOut:
+            data_out();
+            break;
+
+        case MSC_Status:
+            msc.csw.residue = msc.cbw.data_length - msc.valid;
+            USBDevice.send(usb_msc.epIn(), &msc.csw, sizeof(msc_csw_t));
+            msc.phase = MSC_Command;
+            break;
+    }
+}
+
+// Hand the card back when leaving idle so card access does not hold off the realtime loop
+// while the machine moves, the host then sees the medium removed.
+static void msc_state_change (sys_state_t state)
+{
+    if(msc.exposed && state != STATE_IDLE)
+        release();
+
+    if(on_state_change)
+        on_state_change(state);
+}
+
+bool usb_msc_exposed (void)
+{
+    return msc.exposed;
+}
+
+static status_code_t msc_command (sys_state_t state, char *args)
+{
+    if(args) {
+
+        if(!strcmp(args, "1")) {
+            if(!(state == STATE_IDLE && hal.stream.type != StreamType_SDCard))
+                return Status_IdleError;
+            if(!expose())
+                return Status_SDMountError;
+        } else if(!strcmp(args, "0"))
+            release();
+        else
+            return Status_InvalidStatement;
+
+    } else {
+        hal.stream.write("[MSC:");
+        hal.stream.write(uitoa(msc.exposed));
+        hal.stream.write("]" ASCII_EOL);
+    }
+
+    return Status_OK;
+}
+
+void usb_msc_init (void)
+{
+    static const sys_command_t msc_command_list[] = {
+        {"MSC", msc_command, {0}, { .str = "expose SD card as USB drive, $MSC=1 to expose, $MSC=0 to release" } }
+    };
+
+    static sys_commands_t msc_commands = {
+        .n_commands = sizeof(msc_command_list) / sizeof(sys_command_t),
+        .commands = msc_command_list
+    };
+
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = msc_execute_realtime;
+
+    on_state_change = grbl.on_state_change;
+    grbl.on_state_change = msc_state_change;
+
+    system_register_commands(&msc_commands);
+}
+
+#endif // USB_MSC_ENABLE
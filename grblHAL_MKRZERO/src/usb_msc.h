@@ -0,0 +1,44 @@
+/*
+
+  usb_msc.h - USB mass storage (bulk only transport, SCSI) exposing the SD card
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _USB_MSC_H_
+#define _USB_MSC_H_
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void usb_msc_init (void);
+bool usb_msc_exposed (void);
+
+// Implemented in diskio.c, hands the card over to or back from the USB host.
+// FatFs sees the card as not initialized while claimed and remounts it when released.
+void disk_usb_claim (bool claim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -23,20 +23,40 @@
 
 #include <string.h>
 
-#include "Arduino.h"
-
 #include "driver.h"
 
+#if USB_SERIAL_CDC
+
+#include "Arduino.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include "grbl/protocol.h"
 
+#include "usb_serial.h"
+
 #define BLOCK_RX_BUFFER_SIZE 20
 
 static stream_rx_buffer_t rxbuf;
 static stream_block_tx_buffer_t txbuf = {0};
+static struct {
+    size_t length;
+    char data[TX_PRIORITY_BUFFER_SIZE];
+} txpri = {0};
+static tx_stats_t tx_stats = {0};
+
+// Output is queued in two lanes, lanes are switched at line boundaries only.
+// Complete lines in the priority lane are sent as soon as the data handed to the USB stack ends with a LF.
+typedef struct {
+    bool line_start;    // next string written starts a new line
+    bool priority;      // current line is written to the priority lane
+    bool direct;        // current priority line is too long for the lane and written directly
+} usb_writer_t;
+
+static usb_writer_t usb_writer = { .line_start = true };
+static bool tx_midline = false; // last character handed to the USB stack was not a LF
 static on_execute_realtime_ptr on_execute_realtime = NULL;
 static enqueue_realtime_command_ptr enqueue_realtime_command = protocol_enqueue_realtime_command;
 
@@ -86,10 +106,48 @@ static void usbRxCancel (void)
 static bool usbPutC (const char c)
 {
     SerialUSB.write(c);
+    tx_midline = c != ASCII_LF;
 
     return true;
 }
 
+//
+// Sends complete lines from the priority lane if the USB stream is at a line boundary
+//
+static void usbPriorityFlush (void)
+{
+    if(!tx_midline && txpri.length) {
+
+        size_t length = txpri.length;
+
+        while(length && txpri.data[length - 1] != ASCII_LF)
+            length--;
+
+        if(length) {
+            SerialUSB.write((uint8_t *)txpri.data, length);
+            if((txpri.length -= length))
+                memmove(txpri.data, txpri.data + length, txpri.length);
+        }
+    }
+}
+
+//
+// Waits for the USB stack to accept more data, output from nested calls starts on a new line
+//
+static bool usbTxWait (void)
+{
+    bool ok;
+    usb_writer_t writer = usb_writer;
+
+    tx_stats.bulk.waits++;
+    usb_writer.line_start = true;
+    usb_writer.direct = false;
+    ok = hal.stream_blocking_callback();
+    usb_writer = writer;
+
+    return ok;
+}
+
 //
 // Writes current buffer to the USB output stream, swaps buffers
 //
@@ -107,13 +165,23 @@ static inline bool _usb_write (void)
 
                 length = txfree < txbuf.length ? txfree : txbuf.length;
 
+                // End chunk at first line boundary if priority output is pending
+                if(txpri.length) {
+                    char *lf = (char *)memchr(txbuf.s, ASCII_LF, length);
+                    if(lf)
+                        length = lf - txbuf.s + 1;
+                }
+
                 SerialUSB.write((uint8_t *)txbuf.s, length); // doc is wrong - does not return bytes sent!
 
+                tx_midline = txbuf.s[length - 1] != ASCII_LF;
                 txbuf.length -= length;
                 txbuf.s += length;
+
+                usbPriorityFlush();
             }
 
-            if(txbuf.length && !hal.stream_blocking_callback())
+            if(txbuf.length && !usbTxWait())
                 return false;
         }
     }
@@ -124,6 +192,68 @@ static inline bool _usb_write (void)
     return true;
 }
 
+//
+// Writes data directly to the USB output stream, waits for the USB stack to accept it
+//
+static bool usbDirectWrite (const char *s, size_t length)
+{
+    size_t txfree;
+
+    while(length) {
+        if((txfree = SerialUSB.availableForWrite()) > 10) {
+            if(txfree > length)
+                txfree = length;
+            SerialUSB.write((uint8_t *)s, txfree);
+            tx_midline = s[txfree - 1] != ASCII_LF;
+            length -= txfree;
+            s += txfree;
+        } else if(!usbTxWait())
+            return false;
+    }
+
+    return true;
+}
+
+//
+// Adds a string to the priority lane. If there is no room the bulk lane is sent up to its line boundary
+// and the complete lines in the priority lane are sent, blocking until done. Lines are never dropped,
+// a line too long for the lane is written directly to the USB stream.
+//
+static void usbPriorityWrite (const char *s, size_t length)
+{
+    if(!usb_writer.direct && txpri.length + length > TX_PRIORITY_BUFFER_SIZE) {
+
+        tx_stats.priority.waits++;
+
+        if(txbuf.length && !_usb_write())
+            return;
+
+        usbPriorityFlush();
+
+        if(txpri.length + length > TX_PRIORITY_BUFFER_SIZE) {
+            if(!usbDirectWrite(txpri.data, txpri.length))
+                return;
+            txpri.length = 0;
+            usb_writer.direct = true;
+        }
+    }
+
+    if(usb_writer.direct) {
+        usbDirectWrite(s, length);
+        usb_writer.direct = !usb_writer.line_start;
+        return;
+    }
+
+    memcpy(txpri.data + txpri.length, s, length);
+    txpri.length += length;
+
+    if(txpri.length > tx_stats.priority.peak)
+        tx_stats.priority.peak = txpri.length;
+
+    if(usb_writer.line_start)
+        usbPriorityFlush();
+}
+
 //
 // Writes a number of characters from string to the USB output stream, blocks if buffer full
 //
@@ -132,6 +262,9 @@ static void usbWrite (const char *s, uint16_t length)
     if(length == 0)
         return;
 
+    if(txbuf.length + length > tx_stats.bulk.peak)
+        tx_stats.bulk.peak = txbuf.length + length > BLOCK_TX_BUFFER_SIZE ? BLOCK_TX_BUFFER_SIZE : txbuf.length + length;
+
     if(txbuf.length && (txbuf.length + length) > txbuf.max_length) {
         if(!_usb_write())
             return;
@@ -165,12 +298,31 @@ static void usbWriteS (const char *s)
 
     size_t length = strlen(s);
 
+    if(usb_writer.line_start)
+        usb_writer.priority = TX_PRIORITY_LINE(*s);
+
+    usb_writer.line_start = s[length - 1] == ASCII_LF;
+
+    tx_lane_stats_t *stats = usb_writer.priority ? &tx_stats.priority : &tx_stats.bulk;
+
+    stats->bytes += length;
+    if(usb_writer.line_start)
+        stats->lines++;
+
+    if(usb_writer.priority) {
+        usbPriorityWrite(s, length);
+        return;
+    }
+
     if((length + txbuf.length) < BLOCK_TX_BUFFER_SIZE) {
 
         memcpy(txbuf.s, s, length);
         txbuf.length += length;
         txbuf.s += length;
 
+        if(txbuf.length > tx_stats.bulk.peak)
+            tx_stats.bulk.peak = txbuf.length;
+
         if(s[length - 1] == ASCII_LF || txbuf.length > txbuf.max_length) {
             if(!_usb_write())
                 return;
@@ -179,6 +331,11 @@ static void usbWriteS (const char *s)
         usbWrite(s, (uint16_t)length);
 }
 
+const tx_stats_t *usbTxStats (void)
+{
+    return &tx_stats;
+}
+
 //
 // serialGetC - returns -1 if no data available
 //
@@ -302,3 +459,5 @@ const io_stream_t *usbInit (void)
 #ifdef __cplusplus
 }
 #endif
+
+#endif // USB_SERIAL_CDC
@@ -27,7 +27,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "serial.h"
+
 const io_stream_t *usbInit (void);
+const tx_stats_t *usbTxStats (void);
 
 #endif
 
@@ -0,0 +1,281 @@
+/*
+
+  vfd_spindle.c - Modbus RTU VFD spindle
+
+  Register defaults are for Delta/Durapulse GS type drives, override in my_machine.h for other drives.
+  Commands are queued to the Modbus RTU master without waiting for the response, output frequency
+  is polled from the foreground and used for the spindle at speed status and the reported RPM.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "driver.h"
+
+#if VFD_ENABLE
+
+#include <math.h>
+
+#include "vfd_spindle.h"
+#include "modbus_rtu.h"
+
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+
+#ifndef VFD_ADDRESS
+#define VFD_ADDRESS             1
+#endif
+#ifndef VFD_CONTROL_REGISTER
+#define VFD_CONTROL_REGISTER    0x2000
+#endif
+#ifndef VFD_CONTROL_RUN_CW
+#define VFD_CONTROL_RUN_CW      0x0012
+#endif
+#ifndef VFD_CONTROL_RUN_CCW
+#define VFD_CONTROL_RUN_CCW     0x0022
+#endif
+#ifndef VFD_CONTROL_STOP
+#define VFD_CONTROL_STOP        0x0001
+#endif
+#ifndef VFD_FREQUENCY_REGISTER
+#define VFD_FREQUENCY_REGISTER  0x2001 // Set frequency, 0.01 Hz
+#endif
+#ifndef VFD_OUTPUT_FREQ_REGISTER
+#define VFD_OUTPUT_FREQ_REGISTER 0x2103 // Output frequency, 0.01 Hz
+#endif
+#ifndef VFD_RPM_PER_HZ
+#define VFD_RPM_PER_HZ          60.0f
+#endif
+#ifndef VFD_POLL_INTERVAL
+#define VFD_POLL_INTERVAL       250 // ms
+#endif
+#ifndef VFD_POLL_TIMEOUT
+#define VFD_POLL_TIMEOUT        2000 // ms, a poll is given up when no response or exception has been delivered by then
+#endif
+#ifndef VFD_AT_SPEED_TOLERANCE
+#define VFD_AT_SPEED_TOLERANCE  0.05f // fraction of programmed RPM
+#endif
+#ifndef VFD_MAX_RETRIES
+#define VFD_MAX_RETRIES         3 // consecutive communication errors before the spindle alarm is raised
+#endif
+
+#define MODBUS_WRITE_REGISTER   0x06
+#define MODBUS_READ_HOLDING     0x03
+
+typedef enum {
+    VFD_Idle = 0,
+    VFD_SetControl,
+    VFD_SetFrequency,
+    VFD_GetFrequency
+} vfd_request_t;
+
+static struct {
+    spindle_id_t id;
+    spindle_state_t state;
+    float rpm_programmed;
+    float rpm_actual;
+    uint16_t control;
+    uint16_t frequency;
+    bool control_pending;
+    bool frequency_pending;
+    bool poll_pending;
+    uint_fast8_t errors;
+    uint32_t poll_ticks;
+} vfd = {
+    .id = -1
+};
+
+static on_execute_realtime_ptr on_execute_realtime;
+
+static void vfd_rx_packet (modbus_rtu_message_t *msg);
+static void vfd_rx_exception (uint8_t code, void *context);
+
+static const modbus_rtu_callbacks_t callbacks = {
+    .on_rx_packet = vfd_rx_packet,
+    .on_rx_exception = vfd_rx_exception
+};
+
+static bool vfd_write_register (vfd_request_t request, uint16_t reg, uint16_t value)
+{
+    modbus_rtu_message_t msg = {
+        .context = (void *)(uint32_t)request,
+        .tx_length = 6,
+        .rx_length = 8,
+        .adu[0] = VFD_ADDRESS,
+        .adu[1] = MODBUS_WRITE_REGISTER,
+        .adu[2] = reg >> 8,
+        .adu[3] = reg & 0xFF,
+        .adu[4] = value >> 8,
+        .adu[5] = value & 0xFF
+    };
+
+    return modbus_rtu_send(&msg, &callbacks);
+}
+
+static bool vfd_read_register (vfd_request_t request, uint16_t reg)
+{
+    modbus_rtu_message_t msg = {
+        .context = (void *)(uint32_t)request,
+        .tx_length = 6,
+        .rx_length = 7,
+        .adu[0] = VFD_ADDRESS,
+        .adu[1] = MODBUS_READ_HOLDING,
+        .adu[2] = reg >> 8,
+        .adu[3] = reg & 0xFF,
+        .adu[4] = 0,
+        .adu[5] = 1
+    };
+
+    return modbus_rtu_send(&msg, &callbacks);
+}
+
+// Sends pending commands, commands that could not be queued are retried on the next call.
+static void vfd_send_pending (void)
+{
+    if(vfd.control_pending)
+        vfd.control_pending = !vfd_write_register(VFD_SetControl, VFD_CONTROL_REGISTER, vfd.control);
+
+    if(vfd.frequency_pending)
+        vfd.frequency_pending = !vfd_write_register(VFD_SetFrequency, VFD_FREQUENCY_REGISTER, vfd.frequency);
+}
+
+static void vfd_rx_packet (modbus_rtu_message_t *msg)
+{
+    vfd.errors = 0;
+
+    if((vfd_request_t)(uint32_t)msg->context == VFD_GetFrequency) {
+        vfd.poll_pending = false;
+        vfd.rpm_actual = (float)((msg->adu[3] << 8) | msg->adu[4]) * VFD_RPM_PER_HZ / 100.0f;
+    }
+}
+
+static void vfd_rx_exception (uint8_t code, void *context)
+{
+    switch((vfd_request_t)(uint32_t)context) {
+
+        case VFD_SetControl:
+            vfd.control_pending = true;
+            break;
+
+        case VFD_SetFrequency:
+            vfd.frequency_pending = true;
+            break;
+
+        default:
+            vfd.poll_pending = false;
+            break;
+    }
+
+    if(++vfd.errors >= VFD_MAX_RETRIES) {
+        vfd.errors = 0;
+        vfd.control_pending = vfd.frequency_pending = false;
+        if(vfd.state.on && !(state_get() & (STATE_ALARM|STATE_ESTOP)))
+            system_raise_alarm(Alarm_Spindle);
+    }
+}
+
+static void vfd_update_rpm (spindle_ptrs_t *spindle, float rpm)
+{
+    UNUSED(spindle);
+
+    vfd.rpm_programmed = rpm;
+    vfd.frequency = (uint16_t)lroundf(rpm * 100.0f / VFD_RPM_PER_HZ);
+    vfd.frequency_pending = true;
+
+    vfd_send_pending();
+}
+
+static void vfd_set_state (spindle_ptrs_t *spindle, spindle_state_t state, float rpm)
+{
+    UNUSED(spindle);
+
+    vfd.state.on = state.on;
+    vfd.state.ccw = state.ccw;
+    vfd.control = state.on ? (state.ccw ? VFD_CONTROL_RUN_CCW : VFD_CONTROL_RUN_CW) : VFD_CONTROL_STOP;
+    vfd.control_pending = true;
+
+    if(state.on)
+        vfd_update_rpm(spindle, rpm);
+    else {
+        vfd.rpm_programmed = 0.0f;
+        vfd_send_pending();
+    }
+}
+
+static spindle_state_t vfd_get_state (spindle_ptrs_t *spindle)
+{
+    UNUSED(spindle);
+
+    spindle_state_t state = vfd.state;
+
+    state.at_speed = state.on
+                      ? fabsf(vfd.rpm_actual - vfd.rpm_programmed) <= vfd.rpm_programmed * VFD_AT_SPEED_TOLERANCE
+                      : vfd.rpm_actual == 0.0f;
+
+    return state;
+}
+
+static float vfd_get_rpm (spindle_ptrs_t *spindle)
+{
+    UNUSED(spindle);
+
+    return vfd.rpm_actual;
+}
+
+static void vfd_execute_realtime (uint_fast16_t state)
+{
+    on_execute_realtime(state);
+
+    if(vfd.control_pending || vfd.frequency_pending)
+        vfd_send_pending();
+
+    uint32_t ms = hal.get_elapsed_ticks();
+
+    if(vfd.poll_pending && ms - vfd.poll_ticks >= VFD_POLL_TIMEOUT)
+        vfd.poll_pending = false;
+
+    if(!vfd.poll_pending && ms - vfd.poll_ticks >= VFD_POLL_INTERVAL) {
+        vfd.poll_ticks = ms;
+        vfd.poll_pending = vfd_read_register(VFD_GetFrequency, VFD_OUTPUT_FREQ_REGISTER);
+    }
+}
+
+void vfd_init (void)
+{
+    static const spindle_ptrs_t spindle = {
+        .type = SpindleType_VFD,
+        .ref_id = SPINDLE_MODVFD,
+        .set_state = vfd_set_state,
+        .get_state = vfd_get_state,
+        .update_rpm = vfd_update_rpm,
+        .get_rpm = vfd_get_rpm,
+        .cap = {
+            .variable = On,
+            .direction = On,
+            .at_speed = On,
+            .cmd_controlled = On
+        }
+    };
+
+    if(modbus_rtu_init() && (vfd.id = spindle_register(&spindle, "Modbus VFD")) != -1) {
+        on_execute_realtime = grbl.on_execute_realtime;
+        grbl.on_execute_realtime = vfd_execute_realtime;
+    }
+}
+
+#endif // VFD_ENABLE
@@ -0,0 +1,159 @@
+/*
+
+  gcode2tok.c - host side converter for the pre-tokenised SD card job format
+
+  Build: cc -DTOKJOB_HOST -I../src -o gcode2tok gcode2tok.c ../src/tokjob.c
+
+  gcode2tok <input.nc> <output.tok>     - convert G-code to a tokenised job, run with $JOB=<output.tok>
+  gcode2tok -d <input.tok> <output.nc>  - decode a tokenised job back to G-code, for verification
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tokjob.h"
+
+static int file_getc (void *context)
+{
+    int c = fgetc((FILE *)context);
+
+    return c == EOF ? -1 : c;
+}
+
+// Reads a line of any length including the terminating newline, returns NULL at end of file.
+// Comments are removed by the encoder so the length is only checked after that.
+static char *read_line (FILE *in, char **line, size_t *size)
+{
+    size_t length = 0;
+
+    while(true) {
+        if(length + 2 > *size) {
+            char *p = realloc(*line, *size = *size ? *size * 2 : 256);
+            if(p == NULL) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            *line = p;
+        }
+        if(fgets(*line + length, *size - length, in) == NULL)
+            return length ? *line : NULL;
+        length += strlen(*line + length);
+        if((*line)[length - 1] == '\n')
+            return *line;
+    }
+}
+
+static int encode (FILE *in, FILE *out)
+{
+    char *line = NULL;
+    size_t size = 0;
+    uint8_t header[TOKJOB_HEADER_SIZE], block[TOKJOB_MAX_LINE + 3];
+    unsigned long lines = 0, blocks = 0, text = 0, bytes_in = 0, bytes_out = TOKJOB_HEADER_SIZE + 1;
+    int length;
+
+    tokjob_write_header(header);
+    fwrite(header, 1, sizeof(header), out);
+
+    while(read_line(in, &line, &size)) {
+
+        lines++;
+        bytes_in += strlen(line);
+
+        if((length = tokjob_encode_line(line, block, sizeof(block))) < 0) {
+            fprintf(stderr, "line %lu: too long or cannot be encoded\n", lines);
+            free(line);
+            return 1;
+        }
+
+        if(length) {
+            blocks++;
+            if(block[0] == TOKJOB_TEXT)
+                text++;
+            bytes_out += length;
+            fwrite(block, 1, length, out);
+        }
+    }
+
+    free(line);
+    fputc(TOKJOB_EOF, out);
+
+    fprintf(stderr, "%lu lines, %lu blocks (%lu stored as text), %lu -> %lu bytes\n", lines, blocks, text, bytes_in, bytes_out);
+
+    return 0;
+}
+
+static int decode (FILE *in, FILE *out)
+{
+    char line[TOKJOB_MAX_LINE + 1];
+    uint8_t header[TOKJOB_HEADER_SIZE];
+    unsigned long blocks = 0;
+    int length;
+
+    if(fread(header, 1, sizeof(header), in) != sizeof(header) || !tokjob_check_header(header)) {
+        fprintf(stderr, "not a tokenised job file\n");
+        return 1;
+    }
+
+    while((length = tokjob_decode_block(file_getc, in, line, sizeof(line))) >= 0) {
+        blocks++;
+        fprintf(out, "%s\n", line);
+    }
+
+    if(length == TOKJOB_ERROR) {
+        fprintf(stderr, "block %lu: invalid data or missing end of job\n", blocks + 1);
+        return 1;
+    }
+
+    fprintf(stderr, "%lu blocks\n", blocks);
+
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    int status;
+    FILE *in, *out;
+    bool decoding = argc == 4 && !strcmp(argv[1], "-d");
+
+    if(argc != 3 && !decoding) {
+        fprintf(stderr, "usage: gcode2tok [-d] <input> <output>\n");
+        return 2;
+    }
+
+    if((in = fopen(argv[argc - 2], decoding ? "rb" : "r")) == NULL) {
+        perror(argv[argc - 2]);
+        return 1;
+    }
+
+    if((out = fopen(argv[argc - 1], decoding ? "w" : "wb")) == NULL) {
+        perror(argv[argc - 1]);
+        fclose(in);
+        return 1;
+    }
+
+    status = decoding ? decode(in, out) : encode(in, out);
+
+    fclose(in);
+    fclose(out);
+
+    return status;
+}
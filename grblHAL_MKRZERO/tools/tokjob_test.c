@@ -0,0 +1,194 @@
+/*
+
+  tokjob_test.c - host side round-trip test for the pre-tokenised SD card job format
+
+  Build and run: cc -DTOKJOB_HOST -I../src -o tokjob_test tokjob_test.c ../src/tokjob.c && ./tokjob_test
+
+  Each line is encoded and the job decoded again, the result is compared to the expected canonical line.
+  Returns 0 if all tests pass.
+
+  Part of grblHAL
+
+  Copyright (c) 2025 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tokjob.h"
+
+typedef struct {
+    const char *line;
+    const char *decoded;    // NULL if nothing is encoded
+} test_line_t;
+
+static const test_line_t tests[] = {
+    { "G0 X10 Y-2.5\n",                 "G0X10Y-2.5" },
+    { "g1 x0.0001 f1500.000\r\n",       "G1X0.0001F1500" },
+    { "G1 X-.5 Y+3.\n",                 "G1X-0.5Y3" },
+    { "G1 X1.23456789\n",               "G1X1.234568" },
+    { "G1 X0 Y-0.000001 Z2147.483647\n", "G1X0Y-0.000001Z2147.483647" },
+    { "S2147483647 P-2147483647\n",      "S2147483647P-2147483647" },
+    { "G1 X100.5 F10\n",                 "G1X100.5F10" },
+    { "N100 G2 X1 Y1 I0.5 J0 ; arc\n",  "N100G2X1Y1I0.5J0" },
+    { "G1 X1 (move) Y2\n",              "G1X1Y2" },
+    { "(comment only)\n",               NULL },
+    { "; comment only\n",               NULL },
+    { "\n",                             NULL },
+    { "$H\n",                           "$H" },
+    { "G1 X[#1 + 2] (add)\n",           "G1 X[#1 + 2] " },
+    { "(MSG, hello; world) G4 P0 ; c\n", "(MSG, hello; world) G4 P0 " },
+    { "O100 sub\n",                     "O100 sub" }
+};
+
+static const uint8_t *data, *data_end;
+
+static int mem_getc (void *context)
+{
+    (void)context;
+
+    return data < data_end ? *data++ : -1;
+}
+
+static int failed = 0;
+
+static void fail (const char *test, const char *message)
+{
+    failed++;
+    printf("FAIL: %s: %s\n", test, message);
+}
+
+// Encodes the lines into a job, returns job size
+static size_t encode_job (const char *const *lines, size_t n_lines, uint8_t *job, size_t size, bool eof)
+{
+    int length;
+    size_t idx, used = TOKJOB_HEADER_SIZE;
+
+    tokjob_write_header(job);
+
+    for(idx = 0; idx < n_lines; idx++) {
+        if((length = tokjob_encode_line(lines[idx], job + used, size - used - 1)) < 0) {
+            fail(lines[idx], "cannot be encoded");
+            return 0;
+        }
+        used += length;
+    }
+
+    if(eof)
+        job[used++] = TOKJOB_EOF;
+
+    return used;
+}
+
+static void test_round_trip (void)
+{
+    char line[TOKJOB_MAX_LINE + 1];
+    uint8_t job[4096];
+    size_t idx, size;
+    int length;
+
+    for(idx = 0; idx < sizeof(tests) / sizeof(test_line_t); idx++) {
+
+        if((size = encode_job(&tests[idx].line, 1, job, sizeof(job), true)) == 0)
+            continue;
+
+        if(!tokjob_check_header(job)) {
+            fail(tests[idx].line, "invalid header");
+            continue;
+        }
+
+        data = job + TOKJOB_HEADER_SIZE;
+        data_end = job + size;
+
+        if(tests[idx].decoded) {
+            if((length = tokjob_decode_block(mem_getc, NULL, line, sizeof(line))) < 0)
+                fail(tests[idx].line, "decode failed");
+            else if(strcmp(line, tests[idx].decoded) || length != (int)strlen(line)) {
+                fail(tests[idx].line, "decoded line differs");
+                printf("  expected \"%s\", got \"%s\"\n", tests[idx].decoded, line);
+            }
+        }
+
+        if(tokjob_decode_block(mem_getc, NULL, line, sizeof(line)) != TOKJOB_END)
+            fail(tests[idx].line, "end of job not found");
+    }
+}
+
+static void test_missing_eof (void)
+{
+    char line[TOKJOB_MAX_LINE + 1];
+    uint8_t job[256];
+    const char *lines[] = { "G1 X1\n" };
+    size_t size = encode_job(lines, 1, job, sizeof(job), false);
+
+    data = job + TOKJOB_HEADER_SIZE;
+    data_end = job + size;
+
+    if(tokjob_decode_block(mem_getc, NULL, line, sizeof(line)) != 4)
+        fail("missing EOF", "first block not decoded");
+    if(tokjob_decode_block(mem_getc, NULL, line, sizeof(line)) != TOKJOB_ERROR)
+        fail("missing EOF", "truncated job not reported as error");
+
+    // Truncated in the middle of a block
+    data = job + TOKJOB_HEADER_SIZE;
+    data_end = job + size - 2;
+
+    if(tokjob_decode_block(mem_getc, NULL, line, sizeof(line)) != TOKJOB_ERROR)
+        fail("truncated block", "not reported as error");
+}
+
+static void test_long_lines (void)
+{
+    static char text[TOKJOB_MAX_LINE * 2 + 32];
+    uint8_t block[TOKJOB_MAX_LINE + 3];
+
+    // Long comments are removed before the length is checked
+    memset(text, 0, sizeof(text));
+    strcpy(text, "G1 X1 (");
+    memset(text + strlen(text), 'c', TOKJOB_MAX_LINE);
+    strcat(text, ")\n");
+
+    if(tokjob_encode_line(text, block, sizeof(block)) <= 0)
+        fail("long comment", "not encoded");
+
+    strcpy(text, "G1 X[1] (");
+    memset(text + strlen(text), 'c', TOKJOB_MAX_LINE);
+    strcat(text, ")\n");
+
+    if(tokjob_encode_line(text, block, sizeof(block)) <= 0)
+        fail("long comment, text block", "not encoded");
+
+    // A block exceeding the line buffer of the controller is refused
+    memset(text, 0, sizeof(text));
+    memset(text, '1', TOKJOB_MAX_LINE);
+    text[0] = 'X';
+    text[TOKJOB_MAX_LINE] = '[';
+
+    if(tokjob_encode_line(text, block, sizeof(block)) >= 0)
+        fail("long text block", "not refused");
+}
+
+int main (void)
+{
+    test_round_trip();
+    test_missing_eof();
+    test_long_lines();
+
+    printf(failed ? "%d test(s) failed\n" : "All tests passed\n", failed);
+
+    return failed ? 1 : 0;
+}